@@ -12,19 +12,25 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// The cache has NBUF buffers for each 128 megabytes of memory,
+// up to NBUFMAX, allocated by binit() once PHYSTOP is known.
 
 #include "types.h"
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *buf;
+  int nbuf;    // buffers in buf[]
+  int nvalid;  // buffers holding a block's contents
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
@@ -34,13 +40,21 @@ struct {
 
 void binit(void) {
   struct buf *b;
+  int order;
 
   initlock(&bcache.lock, "bcache");
+  bcache.nbuf = NBUF * ((PHYSTOP - KERNBASE) / (128 * 1024 * 1024));
+  if (bcache.nbuf < NBUF) bcache.nbuf = NBUF;
+  if (bcache.nbuf > NBUFMAX) bcache.nbuf = NBUFMAX;
+  for (order = 0; (PGSIZE << order) < bcache.nbuf * sizeof(struct buf); order++)
+    ;
+  if ((bcache.buf = kalloc_pages(order)) == 0) panic("binit");
+  memset(bcache.buf, 0, PGSIZE << order);
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
+  for (b = bcache.buf; b < bcache.buf + bcache.nbuf; b++) {
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
@@ -71,6 +85,7 @@ static struct buf *bget(uint dev, uint blockno) {
   // Recycle the least recently used (LRU) unused buffer.
   for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
     if (b->refcnt == 0) {
+      if (b->valid) __sync_fetch_and_sub(&bcache.nvalid, 1);
       b->dev = dev;
       b->blockno = blockno;
       b->valid = 0;
@@ -91,6 +106,7 @@ struct buf *bread(uint dev, uint blockno) {
   if (!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
+    __sync_fetch_and_add(&bcache.nvalid, 1);
   }
   return b;
 }
@@ -134,3 +150,9 @@ void bunpin(struct buf *b) {
   b->refcnt--;
   release(&bcache.lock);
 }
+
+// The number of buffers holding a block's contents.
+int bcached(void) { return bcache.nvalid; }
+
+// The number of buffers in the cache.
+int bcachesize(void) { return bcache.nbuf; }
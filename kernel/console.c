@@ -44,6 +44,9 @@ void consputc(int c) {
 struct {
   struct spinlock lock;
 
+  // output
+  struct sleeplock wlock;
+
   // input
 #define INPUT_BUF 128
   char buf[INPUT_BUF];
@@ -54,17 +57,21 @@ struct {
 
 //
 // user write()s to the console go here.
+// cons.wlock keeps one write()'s output from being
+// interleaved with another's. it is a sleep-lock, since
+// either_copyin() and uartputc() may sleep.
 //
 int consolewrite(int user_src, uint64 src, int n) {
-  int i;
-
-  acquire(&cons.lock);
-  for (i = 0; i < n; i++) {
-    char c;
-    if (either_copyin(&c, user_src, src + i, 1) == -1) break;
-    uartputc(c);
+  char buf[32];
+  int i, j, m;
+
+  acquiresleep(&cons.wlock);
+  for (i = 0; i < n; i += m) {
+    m = n - i < (int)sizeof(buf) ? n - i : (int)sizeof(buf);
+    if (either_copyin(buf, user_src, src + i, m) == -1) break;
+    for (j = 0; j < m; j++) uartputc(buf[j]);
   }
-  release(&cons.lock);
+  releasesleep(&cons.wlock);
 
   return i;
 }
@@ -104,9 +111,15 @@ int consoleread(int user_dst, uint64 dst, int n) {
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer,
+    // without cons.lock, since either_copyout() may sleep.
     cbuf = c;
-    if (either_copyout(user_dst, dst, &cbuf, 1) == -1) break;
+    release(&cons.lock);
+    if (either_copyout(user_dst, dst, &cbuf, 1) == -1) {
+      acquire(&cons.lock);
+      break;
+    }
+    acquire(&cons.lock);
 
     dst++;
     --n;
@@ -173,6 +186,7 @@ void consoleintr(int c) {
 
 void consoleinit(void) {
   initlock(&cons.lock, "cons");
+  initsleeplock(&cons.wlock, "conswrite");
 
   uartinit();
 
@@ -2,12 +2,16 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
+struct procinfo;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct shm;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -16,14 +20,22 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bcached(void);
+int             bcachesize(void);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dtb.c
+extern uint64   phystop;
+void            dtbinit(void);
+
 // exec.c
 int             exec(char*, char**);
+int             execnew(struct proc*, char*, char**);
+char*           loadpage(struct proc*, uint64, int*);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,6 +52,11 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+int             itextget(struct inode*);
+struct inode*   itextdup(struct inode*);
+void            itextput(struct inode*);
+int             iwriteget(struct inode*);
+void            iwriteput(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -53,6 +70,9 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             icached(void);
+char*           itextpage(struct inode*, uint, uint);
+void            itextstat(uint64*, uint64*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,6 +83,13 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_zeroed(void);
+int             kzero_fill(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+uint64          kfreemem(void);
+void            kdup(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -71,6 +98,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -91,6 +119,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, uint64);
 int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -106,10 +135,20 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeup_one(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             procused(void);
+struct proc*    proclock(int);
+void            procreap(void);
+void            schedstat(uint64*, uint64*, uint64*);
+void            setrunnable(struct proc*);
+void            schedtick(void);
+int             setpriority(int, int);
+int             procinfo(uint64, int);
+void            wssample(void);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -122,6 +161,23 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            kmem_cache_reap(void);
+
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapalloc(void);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapreclaim(void);
+void            swapreserve(int);
+int             swapin(pte_t*);
+uint64          swapfreemem(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -136,6 +192,7 @@ char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
+uint64          strnmove(char*, const char*, uint64);
 
 // syscall.c
 int             argint(int, int*);
@@ -162,22 +219,69 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+uint64          uvmasid(struct proc*);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmfree(pagetable_t);
+void            kvmswitch(struct proc*);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
+int             kvmmapstack(uint64, uint64);
+void            kvmunmapstack(uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+pte_t*          walk(pagetable_t, uint64, int);
+pte_t*          walklevel(pagetable_t, uint64, int*, int);
+int             pgtblpages(pagetable_t);
+void            tlbflush(void);
+void            vmstat(uint64*, uint64*, uint64*);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmevict(struct proc*, uint64*, uint64, uint64*, uint*, int);
+int             cowfault(pagetable_t, uint64);
+int             lazyfault(struct proc*, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmmegapages(pagetable_t);
+void            uvmstat(pagetable_t, struct procinfo*);
+void            uvmsample(struct proc*);
+void            uvmaccess(pagetable_t, uint64, uint64, uchar*);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// vmcopyin.c
+int             copyin_new(pagetable_t, char *, uint64, uint64);
+int             copyinstr_new(pagetable_t, char *, uint64, uint64);
+
+// mmap.c
+struct vma*     vmafind(struct proc*, uint64);
+uint64          mmapbase(struct proc*);
+int             vmaperm(struct vma*);
+char*           vmapage(struct vma*, uint64);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+void            munmapall(struct proc*);
+int             mmapprefault(struct proc*);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapfree(struct proc*);
+uint64          shmat(int);
+int             shmdt(uint64);
+
+// shm.c
+void            shminit(void);
+int             shmget(int, uint64);
+struct shm*     shmattach(int, uint64*);
+void            shmclaim(struct shm*);
+struct shm*     shmdup(struct shm*);
+char*           shmpage(struct shm*, uint64);
+void            shmput(struct shm*);
+void            shmexit(int);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -0,0 +1,133 @@
+//
+// Finding out how much memory the machine has.
+//
+// The boot loader leaves the physical address of a flattened
+// device tree in a1 when it jumps to _entry (see entry.S and
+// start()). dtbinit() walks the tree's structure block for the
+// /memory node and sets phystop to the end of the region that
+// holds the kernel, so that the direct map (kvminit()), the page
+// allocator (kinit()) and the buffer cache (binit()) are sized
+// for the RAM there is rather than for a fixed 128 megabytes.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_BEGIN_NODE 1  // followed by the node's name
+#define FDT_END_NODE 2
+#define FDT_PROP 3  // followed by length, name offset, value
+#define FDT_NOP 4
+#define FDT_END 9
+
+// The header at the start of a device tree.
+// Like everything in the tree, its fields are big-endian.
+struct fdthdr {
+  uint magic;
+  uint totalsize;
+  uint off_struct;   // offset of the structure block
+  uint off_strings;  // offset of the property names
+  uint off_rsvmap;
+  uint version;
+  uint last_comp_version;
+  uint boot_cpuid;
+  uint size_strings;
+  uint size_struct;
+};
+
+uint64 phystop;  // end of the RAM the kernel uses
+
+extern uint64 dtbpa;  // start.c
+extern char end[];    // kernel.ld
+
+static uint be32(void *p) {
+  uchar *b = p;
+  return ((uint)b[0] << 24) | ((uint)b[1] << 16) | ((uint)b[2] << 8) | b[3];
+}
+
+// The number in the n 32-bit cells at p.
+static uint64 cells(uint *p, int n) {
+  uint64 v = 0;
+  for (int i = 0; i < n; i++) v = (v << 32) | be32(&p[i]);
+  return v;
+}
+
+// The end of the (base, size) region in a memory node's
+// reg property that holds KERNBASE, or 0 if none does.
+static uint64 regend(uint *reg, uint len, int ac, int sc) {
+  uint64 base, size;
+
+  if (ac < 1 || ac > 2 || sc < 1 || sc > 2) return 0;
+  for (; len >= (ac + sc) * 4; reg += ac + sc, len -= (ac + sc) * 4) {
+    base = cells(reg, ac);
+    size = cells(reg + ac, sc);
+    if (base <= KERNBASE && KERNBASE - base < size) return base + size;
+  }
+  return 0;
+}
+
+// Walk the device tree at dtbpa for the end of the RAM that
+// holds the kernel. Returns 0 if there is no tree, or it
+// doesn't say.
+static uint64 dtbmemory(void) {
+  struct fdthdr *h = (struct fdthdr *)dtbpa;
+  uint *p, *lim, tok, len;
+  char *strings, *name;
+  int depth = 0, ac = 2, sc = 1, inmem = 0;
+  uint64 top = 0;
+
+  if (h == 0 || be32(&h->magic) != FDT_MAGIC) return 0;
+  p = (uint *)((char *)h + be32(&h->off_struct));
+  lim = (uint *)((char *)p + be32(&h->size_struct));
+  strings = (char *)h + be32(&h->off_strings);
+  while (p < lim && top == 0) {
+    tok = be32(p++);
+    if (tok == FDT_BEGIN_NODE) {
+      // the root is depth 1 and has an empty name;
+      // memory is one of its children, memory@<base>.
+      name = (char *)p;
+      depth++;
+      inmem = depth == 2 && strncmp(name, "memory", 6) == 0;
+      p += (strlen(name) + 4) / 4;  // the name, its NUL, padding
+    } else if (tok == FDT_END_NODE) {
+      depth--;
+      inmem = 0;
+    } else if (tok == FDT_PROP) {
+      len = be32(p);
+      name = strings + be32(p + 1);
+      p += 2;
+      // the root's cell counts come before its children.
+      if (depth == 1 && strncmp(name, "#address-cells", 15) == 0)
+        ac = be32(p);
+      else if (depth == 1 && strncmp(name, "#size-cells", 12) == 0)
+        sc = be32(p);
+      else if (inmem && strncmp(name, "reg", 4) == 0)
+        top = regend(p, len, ac, sc);
+      p += (len + 3) / 4;
+    } else if (tok == FDT_END) {
+      break;
+    } else if (tok != FDT_NOP) {
+      return 0;
+    }
+  }
+  return top;
+}
+
+// Set phystop. Called by main() on the first CPU,
+// before anything allocates memory.
+void dtbinit(void) {
+  uint64 top = dtbmemory();
+
+  if (top <= (uint64)end) {
+    printf("dtbinit: no memory in the device tree, assuming %dMB\n", (int)((PHYSDEFAULT - KERNBASE) >> 20));
+    top = PHYSDEFAULT;
+  }
+  if (top > PHYSMAX) top = PHYSMAX;
+  phystop = PGROUNDDOWN(top);
+#ifdef DEBUG
+  printf("dtbinit: %dMB of memory\n", (int)((phystop - KERNBASE) >> 20));
+#endif
+}
@@ -6,18 +6,48 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+// exec() doesn't read the program's segments into memory.
+// It records where each one lives in the file, and the pages
+// are read in by loadpage() when the program first touches
+// them, so short-lived commands only pay for what they use.
+
+// A program image built by load(), ready to be given to a process.
+struct image {
+  uint64 sz;
+  uint64 entry;
+  uint64 sp;
+  uint64 argc;
+  struct inode *exe;  // the program file, to page in from
+  struct seg seg[NSEG];
+  int nseg;
+};
+
+// PTE permissions for a segment with ELF flags.
+static int flags2perm(int flags) {
+  int perm = PTE_U;
+  if (flags & ELF_PROG_FLAG_READ) perm |= PTE_R;
+  if (flags & ELF_PROG_FLAG_WRITE) perm |= PTE_W | PTE_R;
+  if (flags & ELF_PROG_FLAG_EXEC) perm |= PTE_X;
+  return perm;
+}
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
-
-int exec(char *path, char **argv) {
-  char *s, *last;
+// Build the image of program path, with arguments argv on its
+// stack, in pagetable, which must have no user memory.
+// Returns 0 on success; -1 on failure, with pagetable left
+// with no user memory.
+static int load(char *path, char **argv, pagetable_t pagetable, struct image *im) {
   int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG + 1], stackbase;
+  uint64 argc, sz = 0, sz1 = 0, sp, ustack[MAXARG + 1], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  im->exe = 0;
+  im->nseg = 0;
 
   begin_op();
 
@@ -31,35 +61,39 @@ int exec(char *path, char **argv) {
   if (readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf)) goto bad;
   if (elf.magic != ELF_MAGIC) goto bad;
 
-  if ((pagetable = proc_pagetable(p)) == 0) goto bad;
-
-  // Load program into memory.
+  // Record the program's segments; loadpage() reads them in.
   for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
     if (readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph)) goto bad;
     if (ph.type != ELF_PROG_LOAD) continue;
     if (ph.memsz < ph.filesz) goto bad;
     if (ph.vaddr + ph.memsz < ph.vaddr) goto bad;
-    uint64 sz1;
-    if ((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0) goto bad;
-    sz = sz1;
+    if (ph.vaddr + ph.memsz > MAXUVA) goto bad;
     if (ph.vaddr % PGSIZE != 0) goto bad;
-    if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0) goto bad;
+    if (ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size) goto bad;
+    if (im->nseg >= NSEG) goto bad;
+    im->seg[im->nseg].va = ph.vaddr;
+    im->seg[im->nseg].filesz = ph.filesz;
+    im->seg[im->nseg].memsz = ph.memsz;
+    im->seg[im->nseg].off = ph.off;
+    im->seg[im->nseg].perm = flags2perm(ph.flags);
+    im->nseg++;
+    if (ph.vaddr + ph.memsz > sz) sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep a reference to the file to page in from,
+  // which no one may write while the program runs.
+  if (itextget(ip) < 0) goto bad;
+  iunlock(ip);
   end_op();
+  im->exe = ip;
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
-  uint64 sz1;
+  if (sz + 2 * PGSIZE > MAXUVA) goto bad;
   if ((sz1 = uvmalloc(pagetable, sz, sz + 2 * PGSIZE)) == 0) goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz - 2 * PGSIZE);
-  sp = sz;
+  uvmclear(pagetable, sz);
+  sp = sz1;
   stackbase = sp - PGSIZE;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -79,54 +113,142 @@ int exec(char *path, char **argv) {
   if (sp < stackbase) goto bad;
   if (copyout(pagetable, sp, (char *)ustack, (argc + 1) * sizeof(uint64)) < 0) goto bad;
 
+  im->sz = sz1;
+  im->entry = elf.entry;
+  im->sp = sp;
+  im->argc = argc;
+  return 0;
+
+bad:
+  if (sz1) uvmdealloc(pagetable, sz1, sz);
+  if (ip) {
+    iunlockput(ip);
+    end_op();
+  }
+  if (im->exe) {
+    itextput(im->exe);
+    begin_op();
+    iput(im->exe);
+    end_op();
+  }
+  return -1;
+}
+
+// Give p the image im of program path, apart from its page
+// table and size.
+static void install(struct proc *p, struct image *im, char *path) {
+  char *s, *last;
+
+  p->exe = im->exe;
+  memmove(p->seg, im->seg, sizeof(im->seg));
+  p->nseg = im->nseg;
+  p->trapframe->epc = im->entry;  // initial program counter = main
+  p->trapframe->sp = im->sp;      // initial stack pointer
+
   // arguments to user main(argc, argv)
   // argc is returned via the system call return
   // value, which goes in a0.
-  p->trapframe->a1 = sp;
+  p->trapframe->a1 = im->sp;
 
   // Save program name for debugging.
   for (last = s = path; *s; s++)
     if (*s == '/') last = s + 1;
   safestrcpy(p->name, last, sizeof(p->name));
+}
+
+int exec(char *path, char **argv) {
+  struct image im;
+  struct inode *oldexe;
+  pagetable_t pagetable, oldpagetable, kpagetable, oldkpagetable;
+  struct proc *p = myproc();
+  uint64 oldsz = p->sz;
+
+  if ((pagetable = proc_pagetable(p)) == 0) return -1;
+  if ((kpagetable = kvmcreate(pagetable)) == 0) {
+    proc_freepagetable(pagetable, 0);
+    return -1;
+  }
+  if (load(path, argv, pagetable, &im) < 0) {
+    kvmfree(kpagetable);
+    proc_freepagetable(pagetable, 0);
+    return -1;
+  }
 
   // Commit to the user image.
+  munmapall(p);
   oldpagetable = p->pagetable;
+  oldkpagetable = p->kpagetable;
+  oldexe = p->exe;
+  // procinfo() reads p->pagetable with p->lock held.
+  acquire(&p->lock);
   p->pagetable = pagetable;
-  p->sz = sz;
-  p->trapframe->epc = elf.entry;  // initial program counter = main
-  p->trapframe->sp = sp;          // initial stack pointer
+  p->kpagetable = kpagetable;
+  p->asid = 0;  // a fresh ASID for the new page tables
+  p->sz = im.sz;
+  // stop using the old kernel page table before freeing
+  // the user memory it maps.
+  kvmswitch(p);
+  release(&p->lock);
+  install(p, &im, path);
+  kvmfree(oldkpagetable);
   proc_freepagetable(oldpagetable, oldsz);
-
-  return argc;  // this ends up in a0, the first argument to main(argc, argv)
-
-bad:
-  if (pagetable) proc_freepagetable(pagetable, sz);
-  if (ip) {
-    iunlockput(ip);
+  if (oldexe) {
+    itextput(oldexe);
+    begin_op();
+    iput(oldexe);
     end_op();
   }
-  return -1;
+
+  return im.argc;  // this ends up in a0, the first argument to main(argc, argv)
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
+// Load program path, with arguments argv, into np, a new
+// process with no user memory, for spawn().
 // Returns 0 on success, -1 on failure.
-static int loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz) {
-  uint i, n;
-  uint64 pa;
-
-  if ((va % PGSIZE) != 0) panic("loadseg: va must be page aligned");
-
-  for (i = 0; i < sz; i += PGSIZE) {
-    pa = walkaddr(pagetable, va + i);
-    if (pa == 0) panic("loadseg: address should exist");
-    if (sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if (readi(ip, 0, (uint64)pa, offset + i, n) != n) return -1;
-  }
-
+int execnew(struct proc *np, char *path, char **argv) {
+  struct image im;
+
+  if (load(path, argv, np->pagetable, &im) < 0) return -1;
+  np->sz = im.sz;
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  np->trapframe->a0 = im.argc;
+  install(np, &im, path);
   return 0;
 }
+
+// Return the page of p's memory at page-aligned va, which p
+// hasn't touched yet, and set *perm to the permissions to map it
+// with. A page of a read-only segment comes from the program
+// file's text cache, shared with every process running the
+// program (see itextpage()); any other page is a new one, read
+// from the file if va is part of a segment backed by it, and
+// otherwise zero.
+// Returns 0 if out of memory or the file can't be read.
+char *loadpage(struct proc *p, uint64 va, int *perm) {
+  struct inode *ip = p->exe;
+  struct seg *sg;
+  uint64 n;
+  uint off;
+  char *mem;
+
+  *perm = PTE_W | PTE_X | PTE_R | PTE_U;
+  for (sg = p->seg; sg < &p->seg[p->nseg]; sg++)
+    if (va >= sg->va && va - sg->va < sg->memsz) break;
+  if (sg == &p->seg[p->nseg]) return kalloc_zeroed();  // the heap
+  *perm = sg->perm;
+  if (va - sg->va >= sg->filesz) return kalloc_zeroed();  // bss
+  n = sg->filesz - (va - sg->va);
+  if (n > PGSIZE) n = PGSIZE;
+  off = sg->off + (va - sg->va);
+
+  // no one can change the file while p runs it (see
+  // itextget()), so read it without ip->lock, which the
+  // faulting code may hold, or be holding another inode's.
+  if ((sg->perm & PTE_W) == 0 && off % PGSIZE == 0) {
+    mem = itextpage(ip, off, n);
+  } else if ((mem = kalloc_zeroed()) != 0 && readi(ip, 0, (uint64)mem, off, n) != n) {
+    kfree(mem);
+    mem = 0;
+  }
+  return mem;
+}
@@ -15,26 +15,23 @@
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;       // protects f->ref
+  struct kmem_cache *cache;   // where struct files come from
 } ftable;
 
-void fileinit(void) { initlock(&ftable.lock, "ftable"); }
+void fileinit(void) {
+  initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
+}
 
 // Allocate a file structure.
 struct file *filealloc(void) {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for (f = ftable.file; f < ftable.file + NFILE; f++) {
-    if (f->ref == 0) {
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if ((f = kmem_cache_alloc(ftable.cache)) == 0) return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -57,19 +54,31 @@ void fileclose(struct file *f) {
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if (ff.type == FD_PIPE) {
     pipeclose(ff.pipe, ff.writable);
   } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
+    if (ff.type == FD_INODE && ff.writable) iwriteput(ff.ip);
     begin_op();
     iput(ff.ip);
     end_op();
   }
 }
 
+// Fault in the user pages at addr that a read or write of n
+// bytes copies to or from, before taking the inode's lock. A
+// page of a program is read in from the program file, and its
+// buffers may be held by someone waiting for this file's.
+static void prefault(uint64 addr, int n) {
+  struct proc *p = myproc();
+  uint64 va;
+  char c;
+
+  for (va = PGROUNDDOWN(addr); va < addr + n; va += PGSIZE) copyin(p->pagetable, &c, va, 1);
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int filestat(struct file *f, uint64 addr) {
@@ -99,6 +108,7 @@ int fileread(struct file *f, uint64 addr, int n) {
     if (f->major < 0 || f->major >= NDEV || !devsw[f->major].read) return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if (f->type == FD_INODE) {
+    prefault(addr, n);
     ilock(f->ip);
     if ((r = readi(f->ip, 1, addr, f->off, n)) > 0) f->off += r;
     iunlock(f->ip);
@@ -130,6 +140,7 @@ int filewrite(struct file *f, uint64 addr, int n) {
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
     int i = 0;
+    prefault(addr, n);
     while (i < n) {
       int n1 = n - i;
       if (n1 > max) n1 = max;
@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // icache hash chain
+  int ntext;          // processes running it as their program; see itextget()
+  int nwrite;         // opens for writing or truncating it
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,6 +30,7 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  struct textpage *text; // pages programs map read-only; see itextpage()
 };
 
 // map major device number to device functions.
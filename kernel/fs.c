@@ -40,6 +40,7 @@ void fsinit(int dev) {
   readsb(dev, &sb);
   if (sb.magic != FSMAGIC) panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(dev, &sb);
 }
 
 // Zero a block.
@@ -116,18 +117,18 @@ static void bfree(int dev, uint b) {
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref,
+//   and frees the entry when ref falls to zero. Entries
+//   come from a slab cache, so the number of active inodes
+//   is limited only by memory.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -152,29 +153,35 @@ static void bfree(int dev, uint b) {
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries and the hash chains. Since ip->ref indicates whether
+// an entry is in use, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold icache.lock while using
+// any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// ip->text changes only with both ip->lock and icache.lock held,
+// so either lock is enough to read it.
+
+#define NIHASH 31
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];  // cached inodes, chained by inum
+  int n;                       // inodes in the cache
+  int ntext;                   // pages in the inodes' text caches
 } icache;
 
 void iinit() {
-  int i = 0;
-
   initlock(&icache.lock, "icache");
-  for (i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
 }
 
 static struct inode *iget(uint dev, uint inum);
+static void itextfree(struct inode *ip);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -223,35 +230,95 @@ void iupdate(struct inode *ip) {
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode *iget(uint dev, uint inum) {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
-    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+  for (ip = icache.hash[inum % NIHASH]; ip; ip = ip->next) {
+    if (ip->dev == dev && ip->inum == inum) {
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if (empty == 0 && ip->ref == 0)  // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if (empty == 0) panic("iget: no inodes");
+  // Allocate a new cache entry.
+  if ((ip = kmem_cache_alloc(icache.cache)) == 0) panic("iget: no inodes");
+  icache.n++;
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->ntext = 0;
+  ip->nwrite = 0;
   ip->valid = 0;
+  ip->text = 0;
+  ip->next = icache.hash[inum % NIHASH];
+  icache.hash[inum % NIHASH] = ip;
   release(&icache.lock);
 
   return ip;
 }
 
+// A process is about to run ip as its program. loadpage()
+// reads the program's pages in as they are first used, so
+// ip can't be written or truncated until no process runs it.
+// Returns -1 if it is open for writing already.
+int itextget(struct inode *ip) {
+  int r = -1;
+
+  acquire(&icache.lock);
+  if (ip->nwrite == 0) {
+    ip->ntext++;
+    r = 0;
+  }
+  release(&icache.lock);
+  return r;
+}
+
+// Another process runs ip, after fork().
+// Returns ip, like idup(), whose reference it takes.
+struct inode *itextdup(struct inode *ip) {
+  acquire(&icache.lock);
+  ip->ref++;
+  ip->ntext++;
+  release(&icache.lock);
+  return ip;
+}
+
+// A process has stopped running ip. Caller still
+// holds the reference it took; iput() it next.
+void itextput(struct inode *ip) {
+  acquire(&icache.lock);
+  if (ip->ntext < 1) panic("itextput");
+  ip->ntext--;
+  release(&icache.lock);
+}
+
+// About to open ip to write or truncate it.
+// Returns -1 if a process is running it.
+int iwriteget(struct inode *ip) {
+  int r = -1;
+
+  acquire(&icache.lock);
+  if (ip->ntext == 0) {
+    ip->nwrite++;
+    r = 0;
+  }
+  release(&icache.lock);
+  return r;
+}
+
+// Done writing or truncating ip.
+void iwriteput(struct inode *ip) {
+  acquire(&icache.lock);
+  if (ip->nwrite < 1) panic("iwriteput");
+  ip->nwrite--;
+  release(&icache.lock);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode *idup(struct inode *ip) {
@@ -294,8 +361,8 @@ void iunlock(struct inode *ip) {
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -322,7 +389,131 @@ void iput(struct inode *ip) {
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  if (--ip->ref == 0) {
+    struct inode **pp;
+    itextfree(ip);
+    for (pp = &icache.hash[ip->inum % NIHASH]; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    kmem_cache_free(icache.cache, ip);
+    icache.n--;
+  }
+  release(&icache.lock);
+}
+
+// The number of inodes in the cache.
+int icached(void) { return icache.n; }
+
+// Text cache
+//
+// A page of a program's read-only segments is the same in every
+// process running the program, so loadpage() takes it from the
+// text cache of the program's inode and maps it read-only rather
+// than reading a copy of its own. The cache holds a reference to
+// each page and each mapping holds another, so the page outlives
+// the cache if the file is written to, and the cache outlives the
+// mappings while the inode is in use.
+
+// A page of an inode's text cache.
+struct textpage {
+  char *pa;
+  uint n;  // bytes of it from the file; the rest is zero
+};
+
+#define NTEXTPAGE (PGSIZE / sizeof(struct textpage))
+
+// Return the page of ip's content at page-aligned offset off, of
+// which n bytes come from the file and the rest are zero, with a
+// reference for the caller to map read-only. Reads the page into
+// ip's text cache unless it's there already. ip is a running
+// program, which no one can write (see itextget()), so the caller
+// needn't hold ip->lock. Returns 0 if out of memory or the page
+// can't be read.
+char *itextpage(struct inode *ip, uint off, uint n) {
+  struct textpage *text;
+  uint i = off / PGSIZE;
+  char *mem;
+
+  acquire(&icache.lock);
+  text = ip->text;
+  if (text != 0 && i < NTEXTPAGE && text[i].pa != 0 && text[i].n == n) {
+    kdup(text[i].pa);
+    release(&icache.lock);
+    return text[i].pa;
+  }
+  release(&icache.lock);
+  if ((mem = kalloc_zeroed()) == 0) return 0;
+  if (readi(ip, 0, (uint64)mem, off, n) != n) {
+    kfree(mem);
+    return 0;
+  }
+  // beyond the cache: the caller gets a copy of its own.
+  if (i >= NTEXTPAGE) return mem;
+  text = ip->text == 0 ? kalloc_zeroed() : 0;
+
+  // another process may have cached the page meanwhile,
+  // or cached it with a different length; then the caller
+  // keeps its copy.
+  acquire(&icache.lock);
+  if (ip->text == 0) {
+    ip->text = text;
+    text = 0;
+  }
+  if (ip->text != 0 && ip->text[i].pa == 0) {
+    ip->text[i].pa = mem;
+    ip->text[i].n = n;
+    icache.ntext++;
+    kdup(mem);
+  }
+  release(&icache.lock);
+  if (text) kfree(text);
+  return mem;
+}
+
+// Empty ip's text cache, when the inode leaves the inode cache
+// or its content changes. Processes keep the pages they map.
+// Caller holds icache.lock, and ip->lock unless ip->ref is 0.
+static void itextfree(struct inode *ip) {
+  struct textpage *text = ip->text;
+
+  if (text == 0) return;
+  ip->text = 0;
+  for (int i = 0; i < NTEXTPAGE; i++) {
+    if (text[i].pa) {
+      kfree(text[i].pa);
+      icache.ntext--;
+    }
+  }
+  kfree(text);
+}
+
+// Drop ip's text cache because its content is changing.
+// Caller must hold ip->lock.
+static void itextinval(struct inode *ip) {
+  if (ip->text == 0) return;
+  acquire(&icache.lock);
+  itextfree(ip);
+  release(&icache.lock);
+}
+
+// Count the pages in the text caches, and the mappings of them
+// that share a page rather than having a copy of their own.
+void itextstat(uint64 *npages, uint64 *nshared) {
+  struct inode *ip;
+  int i, j, maps;
+
+  *nshared = 0;
+  acquire(&icache.lock);
+  *npages = icache.ntext;
+  for (i = 0; i < NIHASH; i++) {
+    for (ip = icache.hash[i]; ip; ip = ip->next) {
+      if (ip->text == 0) continue;
+      for (j = 0; j < NTEXTPAGE; j++) {
+        // one reference is the cache's.
+        if (ip->text[j].pa && (maps = krefcnt(ip->text[j].pa) - 1) > 1) *nshared += maps - 1;
+      }
+    }
+  }
   release(&icache.lock);
 }
 
@@ -374,6 +565,8 @@ void itrunc(struct inode *ip) {
   struct buf *bp;
   uint *a;
 
+  itextinval(ip);
+
   for (i = 0; i < NDIRECT; i++) {
     if (ip->addrs[i]) {
       bfree(ip->dev, ip->addrs[i]);
@@ -439,6 +632,7 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
 
   if (off > ip->size || off + n < off) return -1;
   if (off + n > MAXFILE * BSIZE) return -1;
+  itextinval(ip);
 
   for (tot = 0; tot < n; tot += m, off += m, src += m) {
     bp = bread(ip->dev, bmap(ip, off / BSIZE));
@@ -1,31 +1,100 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous runs of 2^order pages.
+//
+// The global pool is a binary buddy allocator: a free block of
+// 2^k pages starts at a page whose index (counted from KERNBASE)
+// is a multiple of 2^k, and freeing a block merges it with its
+// buddy whenever the buddy is free too.
+//
+// Each CPU keeps a small cache of free pages in its struct cpu,
+// so that the common kalloc()/kfree() only touch that CPU's
+// lock. Caches are refilled from, and drained back to, the
+// global pool PCP_BATCH pages at a time. A CPU whose cache
+// and the global pool are both empty steals from other CPUs.
+//
+// Idle CPUs keep a pool of already-zeroed pages topped up for
+// kalloc_zeroed(), taking the memset off the fork/sbrk/exec path.
+// Pages are filled with junk on kalloc()/kfree() only in a
+// DEBUG build.
+//
+// Every page has a reference count, so that copy-on-write fork
+// can share a page between page tables: kalloc() returns a page
+// with one reference, kdup() adds one, and kfree() drops one and
+// only frees the page when none are left.
+//
+// The per-page state array is sized for PHYSTOP, which comes
+// from the device tree (see dtb.c), and so goes right after the
+// kernel, in front of the pages it describes.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
 
+#define PCP_BATCH 32   // pages moved between a cpu cache and kmem at once
+#define PCP_HIGH 128   // a cpu cache longer than this is drained
+#define ZPOOL 256      // pre-zeroed pages kept by idle cpus
+#define ZBATCH 4       // pages zeroed per kzero_fill() call
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[];  // first address after kernel.
                     // defined by kernel.ld.
 
+// A free page or block. Blocks on the buddy free lists
+// are doubly linked so a buddy can be unlinked in O(1);
+// the per-CPU caches only use next.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(i) (KERNBASE + (uint64)(i) * PGSIZE)
+
+// Per-page state, indexed by PA2PG().
+struct page {
+  char order;  // if >= 0, heads a free buddy block of 2^order pages
+  int ref;     // references to an allocated page; 0 if free
+};
+
+struct page *pages;  // one per page from KERNBASE to PHYSTOP
+static uint64 npage;
+static char *kbase;  // the first page kalloc() hands out
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[MAXORDER + 1];  // list heads, one per order
+  uint64 nfree;                   // pages on the free lists
 } kmem;
 
+struct {
+  struct spinlock lock;
+  struct run *list;  // zeroed except for the link in the first word
+  int n;
+} kzero;
+
 void kinit() {
+  struct cpu *c;
+  int i;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void *)PHYSTOP);
+  initlock(&kzero.lock, "kzero");
+  for (c = cpus; c < &cpus[NCPU]; c++) initlock(&c->pglock, "kmem_cpu");
+  for (i = 0; i <= MAXORDER; i++) kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
+  npage = (PHYSTOP - KERNBASE) / PGSIZE;
+  pages = (struct page *)PGROUNDUP((uint64)end);
+  kbase = (char *)PGROUNDUP((uint64)(pages + npage));
+  for (i = 0; i < npage; i++) {
+    pages[i].order = -1;
+    pages[i].ref = 1;  // freerange() drops it
+  }
+  freerange(kbase, (void *)PHYSTOP);
 }
 
 void freerange(void *pa_start, void *pa_end) {
@@ -34,37 +103,361 @@ void freerange(void *pa_start, void *pa_end) {
   for (; p + PGSIZE <= (char *)pa_end; p += PGSIZE) kfree(p);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+static void push(struct run *head, struct run *r) {
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void unlink(struct run *r) {
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Put the block of 2^order pages at pa on the buddy free lists,
+// merging it with its buddy as long as the buddy is free.
+// Caller holds kmem.lock.
+static void buddy_free(uint64 pa, int order) {
+  uint64 i, b;
+
+  i = PA2PG(pa);
+  kmem.nfree += 1L << order;
+  for (; order < MAXORDER; order++) {
+    b = i ^ (1L << order);
+    if (b >= npage || pages[b].order != order) break;
+    unlink((struct run *)PG2PA(b));
+    pages[b].order = -1;
+    if (b < i) i = b;
+  }
+  pages[i].order = order;
+  push(&kmem.free[order], (struct run *)PG2PA(i));
+}
+
+// Take a block of 2^order pages off the buddy free lists,
+// splitting a larger block if necessary.
+// Returns 0 if there is no large enough block.
+// Caller holds kmem.lock.
+static void *buddy_alloc(int order) {
+  struct run *r;
+  uint64 i;
+  int k;
+
+  for (k = order; k <= MAXORDER; k++)
+    if (kmem.free[k].next != &kmem.free[k]) break;
+  if (k > MAXORDER) return 0;
+
+  r = kmem.free[k].next;
+  unlink(r);
+  kmem.nfree -= 1L << order;
+  i = PA2PG(r);
+  pages[i].order = -1;
+  // give back the upper halves we don't need.
+  while (k > order) {
+    k--;
+    pages[i + (1L << k)].order = k;
+    push(&kmem.free[k], (struct run *)PG2PA(i + (1L << k)));
+  }
+  return (void *)r;
+}
+
+// Move up to n pages from the global pool to c's cache.
+// Caller holds c->pglock.
+static void refill(struct cpu *c, int n) {
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while (n-- > 0 && (r = buddy_alloc(0)) != 0) {
+    r->next = c->pgcache;
+    c->pgcache = r;
+    c->npgcache++;
+  }
+  release(&kmem.lock);
+}
+
+// Return n pages from c's cache to the global pool.
+// Caller holds c->pglock.
+static void drain(struct cpu *c, int n) {
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while (n-- > 0 && (r = c->pgcache) != 0) {
+    c->pgcache = r->next;
+    c->npgcache--;
+    buddy_free((uint64)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Take half of the first non-empty cache of another cpu.
+// Keeps one page for the caller and puts the rest in c's cache.
+// Never holds two cpu locks at once.
+static struct run *steal(struct cpu *c) {
+  struct cpu *o;
+  struct run *r, *list;
+  int n;
+
+  for (o = cpus; o < &cpus[NCPU]; o++) {
+    if (o == c) continue;
+    acquire(&o->pglock);
+    n = (o->npgcache + 1) / 2;
+    list = 0;
+    while (n-- > 0) {
+      r = o->pgcache;
+      o->pgcache = r->next;
+      o->npgcache--;
+      r->next = list;
+      list = r;
+    }
+    release(&o->pglock);
+    if (list == 0) continue;
+
+    r = list;
+    list = list->next;
+    acquire(&c->pglock);
+    while (list) {
+      struct run *next = list->next;
+      list->next = c->pgcache;
+      c->pgcache = list;
+      c->npgcache++;
+      list = next;
+    }
+    release(&c->pglock);
+    return r;
+  }
+  return 0;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void kfree(void *pa) {
   struct run *r;
+  struct cpu *c;
+  int ref;
 
-  if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP) panic("kfree");
+  if (((uint64)pa % PGSIZE) != 0 || (char *)pa < kbase || (uint64)pa >= PHYSTOP) panic("kfree");
 
+  ref = __sync_sub_and_fetch(&pages[PA2PG(pa)].ref, 1);
+  if (ref > 0) return;
+  if (ref < 0) panic("kfree: not allocated");
+
+#ifdef DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run *)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = mycpu();
+  acquire(&c->pglock);
+  r->next = c->pgcache;
+  c->pgcache = r;
+  c->npgcache++;
+  if (c->npgcache > PCP_HIGH) drain(c, PCP_BATCH);
+  release(&c->pglock);
+  pop_off();
+}
+
+// Take a free page from this cpu's cache, the global pool,
+// another cpu, or the zero pool, in that order.
+static struct run *kget(void) {
+  struct run *r;
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  acquire(&c->pglock);
+  if (c->pgcache == 0) refill(c, PCP_BATCH);
+  r = c->pgcache;
+  if (r) {
+    c->pgcache = r->next;
+    c->npgcache--;
+  }
+  release(&c->pglock);
+  if (r == 0) r = steal(c);
+  pop_off();
+
+  if (r == 0) {
+    // last resort: the pre-zeroed pool.
+    acquire(&kzero.lock);
+    if ((r = kzero.list) != 0) {
+      kzero.list = r->next;
+      kzero.n--;
+    }
+    release(&kzero.lock);
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
+// If there is none, pages out user memory to make some,
+// if the caller can sleep (see swapreclaim()).
 // Returns 0 if the memory cannot be allocated.
 void *kalloc(void) {
   struct run *r;
 
+  while ((r = kget()) == 0 && swapreclaim() > 0)
+    ;
+  if (r) {
+    pages[PA2PG(r)].ref = 1;
+#ifdef DEBUG
+    memset((char *)r, 5, PGSIZE);  // fill with junk
+#endif
+  }
+  return (void *)r;
+}
+
+// Add a reference to an allocated page, for a page
+// table that is about to share it.
+void kdup(void *pa) {
+  if (((uint64)pa % PGSIZE) != 0 || (char *)pa < kbase || (uint64)pa >= PHYSTOP) panic("kdup");
+  if (__sync_fetch_and_add(&pages[PA2PG(pa)].ref, 1) < 1) panic("kdup: not allocated");
+}
+
+// Number of references to an allocated page.
+int krefcnt(void *pa) { return pages[PA2PG(pa)].ref; }
+
+// Allocate one page of physical memory filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+void *kalloc_zeroed(void) {
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if ((r = kzero.list) != 0) {
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+
+  if (r) {
+    r->next = 0;
+    return (void *)r;
+  }
+  if ((r = kalloc()) != 0) memset(r, 0, PGSIZE);
+  return (void *)r;
+}
+
+// Called by an idle cpu: zero a few pages for kalloc_zeroed().
+// Only does so while a maximal buddy block is free, so that
+// the pool never competes for the last free pages.
+// Returns the number of pages added to the pool.
+int kzero_fill(void) {
+  struct run *r;
+  int n;
+
+  for (n = 0; n < ZBATCH; n++) {
+    if (kzero.n >= ZPOOL || kmem.free[MAXORDER].next == &kmem.free[MAXORDER]) break;
+    if ((r = kalloc()) == 0) break;
+    memset(r, 0, PGSIZE);
+    acquire(&kzero.lock);
+    r->next = kzero.list;
+    kzero.list = r;
+    kzero.n++;
+    release(&kzero.lock);
+  }
+  return n;
+}
+
+// Bytes of free memory, counting the per-CPU caches and the
+// zero pool. Doesn't lock anything, so it is only a snapshot.
+uint64 kfreemem(void) {
+  struct cpu *c;
+  uint64 n;
+
+  n = kmem.nfree + kzero.n;
+  for (c = cpus; c < &cpus[NCPU]; c++) n += c->npgcache;
+  return n * PGSIZE;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size relative to KERNBASE. kalloc_pages(0) is kalloc().
+// Returns 0 if the memory cannot be allocated.
+void *kalloc_pages(int order) {
+  struct cpu *c;
+  void *pa;
+
+  if (order == 0) return kalloc();
+  if (order < 0 || order > MAXORDER) return 0;
+
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if (r) kmem.freelist = r->next;
+  pa = buddy_alloc(order);
   release(&kmem.lock);
 
-  if (r) memset((char *)r, 5, PGSIZE);  // fill with junk
-  return (void *)r;
+  if (pa == 0) {
+    // free pages parked in per-CPU caches and the zero pool
+    // can't coalesce; give them all back and try again.
+    for (c = cpus; c < &cpus[NCPU]; c++) {
+      acquire(&c->pglock);
+      drain(c, c->npgcache);
+      release(&c->pglock);
+    }
+    acquire(&kzero.lock);
+    acquire(&kmem.lock);
+    while (kzero.list) {
+      struct run *r = kzero.list;
+      kzero.list = r->next;
+      kzero.n--;
+      pages[PA2PG(r)].ref = 0;
+      buddy_free((uint64)r, 0);
+    }
+    pa = buddy_alloc(order);
+    release(&kmem.lock);
+    release(&kzero.lock);
+  }
+
+  if (pa) {
+    for (int i = 0; i < (1 << order); i++) pages[PA2PG(pa) + i].ref = 1;
+#ifdef DEBUG
+    memset(pa, 5, PGSIZE << order);  // fill with junk
+#endif
+  }
+  return pa;
+}
+
+// Drop a reference to each page of a block returned by
+// kalloc_pages(order). If no page of the block is referenced
+// any more, the block is freed as a whole; otherwise the pages
+// whose last reference this dropped are freed one by one. A page
+// whose last reference a concurrent kfree() drops is its to free.
+void kfree_pages(void *pa, int order) {
+  uint64 dead[(1 << MAXORDER) / 64];  // pages this took to 0 refs
+  int i, ref, live;
+
+  if (order == 0) {
+    kfree(pa);
+    return;
+  }
+  if (order < 0 || order > MAXORDER || PA2PG(pa) % (1L << order) != 0 || (char *)pa < kbase ||
+      (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  live = 0;
+  memset(dead, 0, sizeof(dead));
+  for (i = 0; i < (1 << order); i++) {
+    ref = __sync_sub_and_fetch(&pages[PA2PG(pa) + i].ref, 1);
+    if (ref < 0) panic("kfree_pages: not allocated");
+    if (ref > 0)
+      live++;
+    else
+      dead[i / 64] |= 1UL << (i % 64);
+  }
+
+#ifdef DEBUG
+  // Fill with junk to catch dangling refs.
+  if (live == 0) memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  if (live == 0) {
+    buddy_free((uint64)pa, order);
+  } else {
+    for (i = 0; i < (1 << order); i++)
+      if (dead[i / 64] & (1UL << (i % 64))) buddy_free((uint64)pa + i * PGSIZE, 0);
+  }
+  release(&kmem.lock);
 }
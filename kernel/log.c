@@ -140,9 +140,9 @@ void end_op(void) {
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    // and decrementing log.outstanding has freed
+    // one operation's reservation: enough for one.
+    wakeup_one(&log);
   }
   release(&log.lock);
 
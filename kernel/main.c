@@ -15,7 +15,9 @@ void main() {
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    dtbinit();           // how much memory there is
     kinit();             // physical page allocator
+    slabinit();          // kernel object caches
     kvminit();           // create kernel page table
     kvminithart();       // turn on paging
     procinit();          // process table
@@ -26,6 +28,8 @@ void main() {
     binit();             // buffer cache
     iinit();             // inode cache
     fileinit();          // file table
+    pipeinit();          // pipe cache
+    shminit();           // shared-memory segments
     virtio_disk_init();  // emulated hard disk
     userinit();          // first user process
     __sync_synchronize();
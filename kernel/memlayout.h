@@ -14,7 +14,7 @@
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
-// end -- start of kernel page allocation area
+// end -- the allocator's per-page array, then its pages
 // PHYSTOP -- end RAM used by the kernel
 
 // qemu puts UART registers here in physical memory.
@@ -43,9 +43,12 @@
 
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
-// from physical address 0x80000000 to PHYSTOP.
+// from physical address 0x80000000 to PHYSTOP, which
+// main() learns from the device tree (see dtb.c).
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSTOP phystop
+#define PHYSDEFAULT (KERNBASE + 128*1024*1024)   // if the device tree doesn't say
+#define PHYSMAX (KERNBASE + 16L*1024*1024*1024)  // RAM above this goes unused
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -53,15 +56,24 @@
 
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
+// they are mapped as processes are created, and
+// stay within the top gigabyte, whose level-1 page
+// table every kernel page table shares.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
+#define NKSTACK ((1L << 30) / (2*PGSIZE) - 1)
 
 // User memory layout.
 // Address zero first:
 //   text
 //   original data and bss
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, up to MAXUVA
 //   ...
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// user memory must lie below MAXUVA, so that a process's
+// kernel page table can map it at the same addresses
+// (see kvmcreate() in vm.c).
+#define MAXUVA PLIC
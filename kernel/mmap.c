@@ -0,0 +1,336 @@
+//
+// Memory-mapped files and anonymous memory: mmap() and munmap().
+//
+// A process's mappings are recorded in p->vma[]. They lie above
+// the heap and below MAXUVA, placed from the top down, and
+// sbrk() can't grow the heap into them. mmap() itself maps no
+// pages; lazyfault() maps each page on first touch, getting it
+// from vmapage(). munmap(), exit() and exec() write the dirty
+// pages of MAP_SHARED file mappings back to the file.
+//
+// shmat() attaches a shared-memory segment (see shm.c) as a
+// MAP_SHARED mapping whose pages belong to the segment.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Return the mapping of p that holds va, or 0 if none.
+struct vma *vmafind(struct proc *p, uint64 va) {
+  struct vma *v;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++)
+    if (v->len != 0 && va >= v->addr && va - v->addr < v->len) return v;
+  return 0;
+}
+
+// The lowest address of p's mappings, or MAXUVA if none.
+// The heap must stay below it.
+uint64 mmapbase(struct proc *p) {
+  uint64 base = MAXUVA;
+  struct vma *v;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++)
+    if (v->len != 0 && v->addr < base) base = v->addr;
+  return base;
+}
+
+// The PTE permission bits for pages of v,
+// or 0 if they can't be accessed at all.
+int vmaperm(struct vma *v) {
+  int perm = 0;
+
+  if (v->prot & PROT_READ) perm |= PTE_R;
+  if (v->prot & PROT_WRITE) perm |= PTE_R | PTE_W;  // risc-v has no write-only pages
+  if (v->prot & PROT_EXEC) perm |= PTE_X;
+  return perm ? perm | PTE_U : 0;
+}
+
+// Return the page to map at page-aligned va in v, with a
+// reference for the caller: the segment's own page if v is
+// attached shared memory, else a new page, read from v's file
+// if it has one, zero past the end of the file.
+// Returns 0 if out of memory or the file can't be read.
+char *vmapage(struct vma *v, uint64 va) {
+  struct inode *ip;
+  char *mem;
+  int r, locked;
+
+  if (v->shm) return shmpage(v->shm, (va - v->addr) / PGSIZE);
+  if ((mem = kalloc_zeroed()) == 0 || v->f == 0) return mem;
+  ip = v->f->ip;
+  // the fault may come from copyin() in a write() to the
+  // mapped file itself, with ip already locked.
+  locked = holdingsleep(&ip->lock);
+  if (!locked) ilock(ip);
+  r = readi(ip, 0, (uint64)mem, v->off + (va - v->addr), PGSIZE);
+  if (!locked) iunlock(ip);
+  if (r < 0) {
+    kfree(mem);
+    return 0;
+  }
+  return mem;
+}
+
+// Write the page at pa, mapped at va in v, back to v's file,
+// a few blocks per transaction as filewrite() does. Doesn't
+// write past the end of the file.
+static void writeback(struct vma *v, uint64 va, uint64 pa) {
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  uint i, n, max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+
+  for (i = 0; i < PGSIZE; i += n) {
+    begin_op();
+    ilock(ip);
+    n = 0;
+    if (off + i < ip->size) {
+      n = ip->size - (off + i);
+      if (n > PGSIZE - i) n = PGSIZE - i;
+      if (n > max) n = max;
+      if (writei(ip, 0, pa + i, off + i, n) != n) n = 0;
+    }
+    iunlock(ip);
+    end_op();
+    if (n == 0) break;
+  }
+}
+
+// Unmap the pages of [va, va+len) in v, writing
+// them back first if v is a shared file mapping.
+static void vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len) {
+  uint64 a;
+  pte_t *pte;
+
+  if (v->f != 0 && (v->flags & MAP_SHARED)) {
+    for (a = va; a < va + len; a += PGSIZE) {
+      pte = walk(p->pagetable, a, 0);
+      if (pte != 0 && (*pte & PTE_V) && (*pte & PTE_D)) writeback(v, a, PTE2PA(*pte));
+    }
+  }
+  uvmunmap(p->pagetable, va, len / PGSIZE, 1);
+}
+
+// Is [va, va+len) free for a new mapping of p?
+static int vmaspace(struct proc *p, uint64 va, uint64 len) {
+  struct vma *v;
+
+  if (va < PGROUNDUP(p->sz) || va + len > MAXUVA) return 0;
+  for (v = p->vma; v < &p->vma[NVMA]; v++)
+    if (v->len != 0 && va < v->addr + v->len && v->addr < va + len) return 0;
+  return 1;
+}
+
+// Find the highest place for a mapping of len bytes: just below
+// MAXUVA or just below one of p's mappings. Returns 0 if there's
+// no room.
+static uint64 vmaplace(struct proc *p, uint64 len) {
+  uint64 top, va = 0;
+  int i;
+
+  for (i = -1; i < NVMA; i++) {
+    if (i >= 0 && p->vma[i].len == 0) continue;
+    top = i < 0 ? MAXUVA : p->vma[i].addr;
+    if (top >= len && top - len > va && vmaspace(p, top - len, len)) va = top - len;
+  }
+  return va;
+}
+
+static struct vma *vmaalloc(struct proc *p) {
+  struct vma *v;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++)
+    if (v->len == 0) return v;
+  return 0;
+}
+
+// Map len bytes of file f, starting at offset off, or of zeroed
+// memory if f is 0, into the current process. addr is only a
+// hint, and is ignored. Returns the address of the mapping, or
+// -1 on error.
+uint64 mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off) {
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if (len == 0 || len > MAXUVA || off % PGSIZE != 0) return -1;
+  if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) return -1;
+  if (f != 0) {
+    if (f->type != FD_INODE || !f->readable) return -1;
+    // a private mapping's writes never reach the file.
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable) return -1;
+  }
+
+  len = PGROUNDUP(len);
+  if ((v = vmaalloc(p)) == 0 || (addr = vmaplace(p, len)) == 0) return -1;
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = f ? off : 0;
+  v->shm = 0;
+  return addr;
+}
+
+// Unmap [addr, addr+len) from the current process. The range
+// must lie within a single mapping; a hole in the middle of one
+// splits it in two. Returns 0 on success, -1 on error.
+int munmap(uint64 addr, uint64 len) {
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 end;
+
+  if (addr % PGSIZE != 0 || len == 0) return -1;
+  end = addr + PGROUNDUP(len);
+  if ((v = vmafind(p, addr)) == 0 || end < addr || end > v->addr + v->len) return -1;
+  if (v->shm) return -1;  // use shmdt()
+
+  if (end < v->addr + v->len && addr > v->addr) {
+    // the part above the hole becomes a mapping of its own.
+    if ((nv = vmaalloc(p)) == 0) return -1;
+    *nv = *v;
+    nv->addr = end;
+    nv->len = v->addr + v->len - end;
+    nv->off = v->off + (end - v->addr);
+    if (nv->f) filedup(nv->f);
+    v->len = end - v->addr;
+  }
+
+  vmaunmap(p, v, addr, end - addr);
+  if (addr == v->addr) {
+    v->addr = end;
+    v->off += end - addr;
+  }
+  v->len -= end - addr;
+  if (v->len == 0 && v->f) {
+    fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Unmap all of p's mappings. Called by exit()
+// and exec(), without spinlocks held.
+void munmapall(struct proc *p) {
+  struct vma *v;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len == 0) continue;
+    vmaunmap(p, v, v->addr, v->len);
+    if (v->f) fileclose(v->f);
+    if (v->shm) shmput(v->shm);
+    v->f = 0;
+    v->shm = 0;
+    v->len = 0;
+  }
+}
+
+// Fault in every page of p's MAP_SHARED mappings, so that
+// fork() can share all of them with the child. Attached
+// shared memory needs no help: the child can get its pages
+// from the segment, just as the parent does. Called by
+// fork() before it takes any locks, since reading pages
+// from a file may sleep.
+// Returns 0 on success, -1 if out of memory.
+int mmapprefault(struct proc *p) {
+  struct vma *v;
+  pte_t *pte;
+  uint64 a;
+
+  for (v = p->vma; v < &p->vma[NVMA]; v++) {
+    if (v->len == 0 || (v->flags & MAP_SHARED) == 0 || v->shm || vmaperm(v) == 0) continue;
+    for (a = v->addr; a < v->addr + v->len; a += PGSIZE) {
+      if ((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V)) continue;
+      if (lazyfault(p, a) != 0) return -1;
+    }
+  }
+  return 0;
+}
+
+// Give child np the same mappings as p. Pages of MAP_SHARED
+// mappings are shared; those of MAP_PRIVATE ones are
+// copy-on-write, like the rest of memory.
+// Returns 0 on success, -1 if out of memory, in which case
+// freeproc(np) cleans up.
+int mmapfork(struct proc *p, struct proc *np) {
+  int i;
+
+  for (i = 0; i < NVMA; i++) {
+    if (p->vma[i].len == 0) continue;
+    if (uvmcopyrange(p->pagetable, np->pagetable, p->vma[i].addr, p->vma[i].addr + p->vma[i].len,
+                     p->vma[i].flags & MAP_SHARED) != 0)
+      return -1;
+    np->vma[i] = p->vma[i];
+    np->vma[i].f = 0;
+    np->vma[i].shm = 0;
+  }
+  for (i = 0; i < NVMA; i++) {
+    if (p->vma[i].len == 0) continue;
+    if (p->vma[i].f) np->vma[i].f = filedup(p->vma[i].f);
+    if (p->vma[i].shm) np->vma[i].shm = shmdup(p->vma[i].shm);
+  }
+  return 0;
+}
+
+// Free the pages of any mappings np still has, without
+// touching their files or segments. For freeproc(), which holds
+// np->lock; exit() has already unmapped everything with
+// munmapall(), and a failed mmapfork() takes no references.
+void mmapfree(struct proc *np) {
+  struct vma *v;
+
+  for (v = np->vma; v < &np->vma[NVMA]; v++) {
+    if (v->len == 0) continue;
+    uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+    v->len = 0;
+    v->f = 0;
+    v->shm = 0;
+  }
+}
+
+// Attach shared-memory segment id to the current process.
+// Returns the address of the attachment, or -1 on error.
+uint64 shmat(int id) {
+  struct proc *p = myproc();
+  struct vma *v;
+  struct shm *s;
+  uint64 addr, len;
+
+  if ((v = vmaalloc(p)) == 0 || (s = shmattach(id, &len)) == 0) return -1;
+  if ((addr = vmaplace(p, len)) == 0) {
+    shmput(s);
+    return -1;
+  }
+  v->addr = addr;
+  v->len = len;
+  v->prot = PROT_READ | PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->f = 0;
+  v->off = 0;
+  v->shm = s;
+  shmclaim(s);
+  return addr;
+}
+
+// Detach the shared-memory segment attached at addr from
+// the current process. Returns 0 on success, -1 on error.
+int shmdt(uint64 addr) {
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if ((v = vmafind(p, addr)) == 0 || v->shm == 0 || v->addr != addr) return -1;
+  vmaunmap(p, v, v->addr, v->len);
+  shmput(v->shm);
+  v->shm = 0;
+  v->len = 0;
+  return 0;
+}
@@ -1,13 +1,23 @@
-#define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NSEG          4  // max loadable segments in a program
+#define NVMA         16  // mmap() regions per process
+#define NSHM         16  // shared-memory segments
+#define WSTICKS      10  // ticks between working-set samples
+#define NICEMIN     -20  // nice value of the most favoured process
+#define NICEMAX      19  // nice value of the least favoured process
+#define NPRIO         4  // MLFQ priority levels
+#define MLFQSLICE     1  // MLFQ time slice at the top level, in ticks; doubles with each level down
+#define MLFQBOOST   100  // ticks between MLFQ priority boosts
+#define CFSSLEEP 1000000 // CFS vruntime credit for a waking process, in mtime cycles
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // disk block cache size per 128MB of memory
+#define NBUFMAX      (NBUF*8)         // largest disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define SWAPSIZE     65536 // size of swap area in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER      10   // largest kalloc_pages() block is 2^MAXORDER pages
@@ -9,6 +9,7 @@
 #include "file.h"
 
 #define PIPESIZE 512
+#define PIPECHUNK 64  // bytes copied to or from the user at a time
 
 struct pipe {
   struct spinlock lock;
@@ -17,19 +18,25 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int reading;    // a reader is copying out bytes it hasn't consumed
 };
 
+struct kmem_cache *pipecache;
+
+void pipeinit(void) { pipecache = kmem_cache_create("pipe", sizeof(struct pipe)); }
+
 int pipealloc(struct file **f0, struct file **f1) {
   struct pipe *pi;
 
   pi = 0;
   *f0 = *f1 = 0;
   if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0) goto bad;
-  if ((pi = (struct pipe *)kalloc()) == 0) goto bad;
+  if ((pi = (struct pipe *)kmem_cache_alloc(pipecache)) == 0) goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->reading = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -42,7 +49,7 @@ int pipealloc(struct file **f0, struct file **f1) {
   return 0;
 
 bad:
-  if (pi) kfree((char *)pi);
+  if (pi) kmem_cache_free(pipecache, pi);
   if (*f0) fileclose(*f0);
   if (*f1) fileclose(*f1);
   return -1;
@@ -59,53 +66,78 @@ void pipeclose(struct pipe *pi, int writable) {
   }
   if (pi->readopen == 0 && pi->writeopen == 0) {
     release(&pi->lock);
-    kfree((char *)pi);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// The user copies in pipewrite() and piperead() happen with
+// pi->lock released, PIPECHUNK bytes at a time: touching a user
+// page may have to read it in from the program file, which
+// sleeps, on a kernel stack with no room for a bigger buffer.
+
 int pipewrite(struct pipe *pi, uint64 addr, int n) {
-  int i;
-  char ch;
+  int i, j, m;
+  char buf[PIPECHUNK];
   struct proc *pr = myproc();
 
-  acquire(&pi->lock);
-  for (i = 0; i < n; i++) {
-    while (pi->nwrite == pi->nread + PIPESIZE) {  // DOC: pipewrite-full
-      if (pi->readopen == 0 || pr->killed) {
-        release(&pi->lock);
-        return -1;
+  for (i = 0; i < n; i += m) {
+    m = n - i;
+    if (m > PIPECHUNK) m = PIPECHUNK;
+    if (copyin(pr->pagetable, buf, addr + i, m) == -1) break;
+    acquire(&pi->lock);
+    for (j = 0; j < m; j++) {
+      while (pi->nwrite == pi->nread + PIPESIZE) {  // DOC: pipewrite-full
+        if (pi->readopen == 0 || pr->killed) {
+          release(&pi->lock);
+          return -1;
+        }
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
       }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+      pi->data[pi->nwrite++ % PIPESIZE] = buf[j];
     }
-    if (copyin(pr->pagetable, &ch, addr + i, 1) == -1) break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    wakeup(&pi->nread);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
   return i;
 }
 
+// A reader consumes bytes only once it has copied them out, so
+// that a bad addr doesn't lose them; pi->reading keeps other
+// readers off them meanwhile. Returns the bytes copied out,
+// stopping at a bad addr.
 int piperead(struct pipe *pi, uint64 addr, int n) {
-  int i;
+  int i, j, m, r;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPECHUNK];
 
   acquire(&pi->lock);
-  while (pi->nread == pi->nwrite && pi->writeopen) {  // DOC: pipe-empty
+  while (pi->reading || (pi->nread == pi->nwrite && pi->writeopen)) {  // DOC: pipe-empty
     if (pr->killed) {
       release(&pi->lock);
       return -1;
     }
-    sleep(&pi->nread, &pi->lock);  // DOC: piperead-sleep
+    if (pi->reading)
+      sleep(&pi->reading, &pi->lock);
+    else
+      sleep(&pi->nread, &pi->lock);  // DOC: piperead-sleep
   }
-  for (i = 0; i < n; i++) {  // DOC: piperead-copy
-    if (pi->nread == pi->nwrite) break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if (copyout(pr->pagetable, addr + i, &ch, 1) == -1) break;
+  pi->reading = 1;
+  for (i = 0; i < n && pi->nread != pi->nwrite; i += m) {  // DOC: piperead-copy
+    m = n - i;
+    if (m > pi->nwrite - pi->nread) m = pi->nwrite - pi->nread;
+    if (m > PIPECHUNK) m = PIPECHUNK;
+    for (j = 0; j < m; j++) buf[j] = pi->data[(pi->nread + j) % PIPESIZE];
+    release(&pi->lock);
+    r = copyout(pr->pagetable, addr + i, buf, m);
+    acquire(&pi->lock);
+    if (r == -1) break;
+    pi->nread += m;
+    wakeup(&pi->nwrite);  // DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  // DOC: piperead-wakeup
+  pi->reading = 0;
+  wakeup(&pi->reading);
   release(&pi->lock);
   return i;
 }
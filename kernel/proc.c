@@ -5,40 +5,94 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sysinfo.h"
+#include "spawn.h"
+#ifdef SCHED_CFS
+#include "sched.h"
+#endif
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
-
 struct proc *initproc;
 
 int nextpid = 1;
-struct spinlock pid_lock;
+
+// Processes are allocated from a slab cache as they are needed,
+// each with a kernel stack in a free KSTACK() slot, so there is
+// no limit on them but memory. freeproc() keeps a proc, stack
+// and all, for the next allocproc(); an idle cpu hands the ones
+// no one took back to the slab cache and kalloc() (procreap()).
+// It waits until no wake() is under way on any cpu, since wake()
+// may lock a process it took off a wait queue after it has been
+// freed; wake() runs with interrupts off, so it stays on one cpu
+// and counts itself in that cpu's c->waking.
+// A cpu that may have the translation of a slot's old stack in
+// its TLB flushes it before running the process with the new
+// one (see scheduler()).
+static struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct proc *free;  // freed procs, linked through p->allnext
+  uchar slot[(NKSTACK + 7) / 8];  // KSTACK() slots in use
+  int next;           // where newproc() looks first for a slot
+  int nkstack;        // slots below this have been used before
+  uint64 kstackgen;   // bumped each time one is used again
+} procmem;
+
+// Processes in use, in pid order, and hashed by pid.
+// Lock order: wait_lock, then any p->lock.
+#define NPIDHASH 1024
+
+static struct proc *allproc;  // first; linked through p->allnext
+static struct proc *lastproc;
+static struct proc *pidhash[NPIDHASH];  // linked through p->pidnext
+static int nused;  // processes in use
+
+// helps ensure that wakeups of wait()ing
+// parents are not lost. helps obey the
+// memory model when using p->parent.
+// also protects the process lists and nextpid.
+// must be acquired before any p->lock.
+struct spinlock wait_lock;
+
+static uint wsnext;  // tick of the next working-set sample
+#ifdef SCHED_MLFQ
+static uint boostnext;  // tick of the next priority boost
+#endif
 
 extern void forkret(void);
-static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static int leastbusy(void);
+static void schednew(struct proc *np, struct proc *parent);
+static void unsleep(struct proc *p);
 
 extern char trampoline[];  // trampoline.S
 
-// initialize the proc table at boot time.
-void procinit(void) {
-  struct proc *p;
+// Sleeping processes, hashed by channel, so that wakeup() only
+// looks at processes that may be sleeping on its channel. A
+// process is on the queue for p->chan from when sleep() puts it
+// there until a wakeup() or kill() takes it off. Lock order:
+// p->lock, then a queue's lock.
+#define NWAITQ 61
+#define WAKEBATCH 16  // sleepers wake() takes off a queue at once
 
-  initlock(&pid_lock, "nextpid");
-  for (p = proc; p < &proc[NPROC]; p++) {
-    initlock(&p->lock, "proc");
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;  // first to sleep; linked through p->wqnext
+  struct proc *tail;
+};
 
-    // Allocate a page for the process's kernel stack.
-    // Map it high in memory, followed by an invalid
-    // guard page.
-    char *pa = kalloc();
-    if (pa == 0) panic("kalloc");
-    uint64 va = KSTACK((int)(p - proc));
-    kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-    p->kstack = va;
-  }
-  kvminithart();
+static struct waitq waitq[NWAITQ];
+
+// initialize the process lists at boot time.
+void procinit(void) {
+  struct cpu *c;
+
+  initlock(&procmem.lock, "procmem");
+  procmem.cache = kmem_cache_create("proc", sizeof(struct proc));
+  initlock(&wait_lock, "wait_lock");
+  for (c = cpus; c < &cpus[NCPU]; c++) initlock(&c->rqlock, "runq");
+  for (int i = 0; i < NWAITQ; i++) initlock(&waitq[i].lock, "waitq");
 }
 
 // Must be called with interrupts disabled,
@@ -66,48 +120,136 @@ struct proc *myproc(void) {
   return p;
 }
 
-int allocpid() {
-  int pid;
+// An UNUSED proc: a freed one, or a new one with a kernel
+// stack. Returns 0 if out of memory.
+static struct proc *newproc(void) {
+  struct proc *p;
+  char *pa;
+  int i, s;
+
+  acquire(&procmem.lock);
+  if ((p = procmem.free) != 0) {
+    procmem.free = p->allnext;
+    p->allnext = 0;
+    release(&procmem.lock);
+    return p;
+  }
+  release(&procmem.lock);
 
-  acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
-  release(&pid_lock);
+  if ((p = kmem_cache_alloc(procmem.cache)) == 0) return 0;
+  if ((pa = kalloc()) == 0) {
+    kmem_cache_free(procmem.cache, p);
+    return 0;
+  }
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+
+  // Map the stack high in memory, followed by an invalid
+  // guard page.
+  acquire(&procmem.lock);
+  for (i = 0; i < NKSTACK; i++) {
+    s = (procmem.next + i) % NKSTACK;
+    if ((procmem.slot[s / 8] & (1 << (s % 8))) == 0) break;
+  }
+  if (i == NKSTACK || kvmmapstack(KSTACK(s), (uint64)pa) < 0) {
+    release(&procmem.lock);
+    kfree(pa);
+    kmem_cache_free(procmem.cache, p);
+    return 0;
+  }
+  procmem.slot[s / 8] |= 1 << (s % 8);
+  procmem.next = s + 1;
+  if (s < procmem.nkstack)
+    p->kstackgen = ++procmem.kstackgen;
+  else
+    procmem.nkstack = s + 1;
+  p->kstack = KSTACK(s);
+  release(&procmem.lock);
+  return p;
+}
 
-  return pid;
+// Give the procs freeproc() kept back to the slab cache, and
+// their stacks back to kalloc(). Called by an idle cpu.
+void procreap(void) {
+  struct proc *p, *next;
+  struct cpu *c;
+  int s;
+
+  if (procmem.free == 0) return;  // unlocked; only a hint
+  acquire(&procmem.lock);
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    if (__atomic_load_n(&c->waking, __ATOMIC_ACQUIRE) != 0) {
+      release(&procmem.lock);
+      return;
+    }
+  }
+  for (p = procmem.free; p; p = next) {
+    next = p->allnext;
+    kvmunmapstack(p->kstack);
+    s = (TRAMPOLINE - p->kstack) / (2 * PGSIZE) - 1;
+    procmem.slot[s / 8] &= ~(1 << (s % 8));
+    kmem_cache_free(procmem.cache, p);
+  }
+  procmem.free = 0;
+  release(&procmem.lock);
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
-static struct proc *allocproc(void) {
+// The process with the given pid, or 0.
+// Caller holds wait_lock.
+static struct proc *pidlookup(int pid) {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
+  if (pid <= 0) return 0;
+  for (p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if (p->pid == pid) return p;
   return 0;
+}
 
-found:
-  p->pid = allocpid();
+// Put p on list *l, a parent's children or zombies.
+// Caller holds wait_lock.
+static void sibadd(struct proc **l, struct proc *p) {
+  p->sibprev = 0;
+  p->sibnext = *l;
+  if (*l) (*l)->sibprev = p;
+  *l = p;
+}
+
+// Take p off list *l. Caller holds wait_lock.
+static void sibremove(struct proc **l, struct proc *p) {
+  if (p->sibprev)
+    p->sibprev->sibnext = p->sibnext;
+  else
+    *l = p->sibnext;
+  if (p->sibnext) p->sibnext->sibprev = p->sibprev;
+  p->sibnext = p->sibprev = 0;
+}
+
+// Make np a child of p. Caller holds wait_lock.
+static void adopt(struct proc *p, struct proc *np) {
+  np->parent = p;
+  sibadd(&p->children, np);
+}
+
+// Allocate a proc, and initialize the state required
+// to run in the kernel. Returns with p->lock held,
+// or 0 if a memory allocation fails.
+static struct proc *allocproc(void) {
+  struct proc *p;
+
+  if ((p = newproc()) == 0) return 0;
 
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe *)kalloc()) == 0) {
-    release(&p->lock);
+    freeproc(p);
     return 0;
   }
 
-  // An empty user page table.
+  // An empty user page table, and the kernel page table
+  // that mirrors it.
   p->pagetable = proc_pagetable(p);
-  if (p->pagetable == 0) {
+  p->asid = 0;
+  if (p->pagetable == 0 || (p->kpagetable = kvmcreate(p->pagetable)) == 0) {
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
 
@@ -117,25 +259,88 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  // pids only grow, so the list stays in pid order.
+  acquire(&wait_lock);
+  acquire(&p->lock);
+  p->pid = nextpid++;
+  p->state = USED;
+  p->allnext = 0;
+  p->allprev = lastproc;
+  if (lastproc)
+    lastproc->allnext = p;
+  else
+    allproc = p;
+  lastproc = p;
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
+  nused++;
+  release(&wait_lock);
+
+  p->cpu = leastbusy();
+  schednew(p, 0);
   return p;
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages, and keep it for newproc().
+// wait_lock and p->lock must be held if p is in use.
 static void freeproc(struct proc *p) {
+  struct proc **pp;
+
   if (p->trapframe) kfree((void *)p->trapframe);
   p->trapframe = 0;
-  if (p->pagetable) proc_freepagetable(p->pagetable, p->sz);
+  if (p->kpagetable) kvmfree(p->kpagetable);
+  p->kpagetable = 0;
+  if (p->pagetable) {
+    mmapfree(p);
+    proc_freepagetable(p->pagetable, p->sz);
+  }
   p->pagetable = 0;
+  p->asid = 0;
   p->sz = 0;
+
+  if (p->state != UNUSED) {
+    if (p->parent) sibremove(p->state == ZOMBIE ? &p->parent->zombies : &p->parent->children, p);
+    if (p->allprev)
+      p->allprev->allnext = p->allnext;
+    else
+      allproc = p->allnext;
+    if (p->allnext)
+      p->allnext->allprev = p->allprev;
+    else
+      lastproc = p->allprev;
+    p->allprev = 0;
+    for (pp = &pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+      ;
+    *pp = p->pidnext;
+    p->pidnext = 0;
+    nused--;
+  }
+
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
+  p->pageable = 0;
+  p->wss = p->wsrss = 0;
   p->xstate = 0;
   p->state = UNUSED;
+
+  acquire(&procmem.lock);
+  p->allnext = procmem.free;
+  procmem.free = p;
+  release(&procmem.lock);
+}
+
+// Free np, which allocproc() handed out but which
+// never ran. Caller must not hold np->lock.
+static void discardproc(struct proc *np) {
+  acquire(&wait_lock);
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  release(&wait_lock);
 }
 
 // Create a user page table for a given process,
@@ -202,7 +407,7 @@ void userinit(void) {
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
@@ -210,7 +415,7 @@ void userinit(void) {
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n) {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
@@ -219,7 +424,8 @@ int growproc(int n) {
       return -1;
     }
   } else if (n < 0) {
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // fails if a megapage has to be split and memory is short.
+    if ((sz = uvmdealloc(p->pagetable, sz, sz + n)) != p->sz + n) return -1;
   }
   p->sz = sz;
   return 0;
@@ -232,21 +438,25 @@ int fork(void) {
   struct proc *np;
   struct proc *p = myproc();
 
+  // Bring in all of the pages fork() shares, while
+  // it can still sleep.
+  if (mmapprefault(p) < 0) return -1;
+  // and make room for the child's page tables.
+  swapreserve(pgtblpages(p->pagetable) + 4);
+
   // Allocate process.
   if ((np = allocproc()) == 0) {
     return -1;
   }
 
   // Copy user memory from parent to child.
-  if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
-    freeproc(np);
+  if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 || mmapfork(p, np) < 0) {
     release(&np->lock);
+    discardproc(np);
     return -1;
   }
   np->sz = p->sz;
 
-  np->parent = p;
-
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -257,40 +467,118 @@ int fork(void) {
   for (i = 0; i < NOFILE; i++)
     if (p->ofile[i]) np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if (p->exe) np->exe = itextdup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  adopt(p, np);
+  release(&wait_lock);
 
+  acquire(&np->lock);
+  schednew(np, p);
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Create a new process running program path with arguments
+// argv, without copying the current process's memory. The child
+// starts with the parent's open files, changed by the file
+// actions at user address ufa (see spawn.h), if it isn't 0.
+// Returns the child's pid, or -1.
+int spawn(char *path, char **argv, uint64 ufa) {
+  int i, n, pid;
+  struct spawnfa fa;
+  struct file *f;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if ((np = allocproc()) == 0) return -1;
+  // np is USED, so no one else will take it. Don't hold its
+  // lock while reading the program, which may sleep.
+  release(&np->lock);
+
+  if (execnew(np, path, argv) < 0) goto bad;
+
+  for (i = 0; i < NOFILE; i++)
+    if (p->ofile[i]) np->ofile[i] = filedup(p->ofile[i]);
+  for (n = 0; ufa != 0; ufa += sizeof(fa)) {
+    if (copyin(p->pagetable, (char *)&fa, ufa, sizeof(fa)) < 0) goto bad;
+    if (fa.op == SPAWN_END) break;
+    if (++n > MAXSPAWNFA) goto bad;
+    if (fa.fd < 0 || fa.fd >= NOFILE || (f = np->ofile[fa.fd]) == 0) goto bad;
+    switch (fa.op) {
+      case SPAWN_DUP2:
+        if (fa.newfd < 0 || fa.newfd >= NOFILE) goto bad;
+        if (fa.newfd == fa.fd) break;
+        if (np->ofile[fa.newfd]) fileclose(np->ofile[fa.newfd]);
+        np->ofile[fa.newfd] = filedup(f);
+        break;
+      case SPAWN_CLOSE:
+        np->ofile[fa.fd] = 0;
+        fileclose(f);
+        break;
+      default:
+        goto bad;
+    }
+  }
+  np->cwd = idup(p->cwd);
+
+  acquire(&wait_lock);
+  adopt(p, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  pid = np->pid;
+  schednew(np, p);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+
+bad:
+  for (i = 0; i < NOFILE; i++) {
+    if (np->ofile[i]) {
+      fileclose(np->ofile[i]);
+      np->ofile[i] = 0;
+    }
+  }
+  if (np->exe) {
+    itextput(np->exe);
+    begin_op();
+    iput(np->exe);
+    end_op();
+    np->exe = 0;
+    np->nseg = 0;
+  }
+  discardproc(np);
+  return -1;
+}
+
 // Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Caller must hold wait_lock.
 void reparent(struct proc *p) {
   struct proc *pp;
 
-  for (pp = proc; pp < &proc[NPROC]; pp++) {
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if (pp->parent == p) {
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
+  while ((pp = p->children) != 0) {
+    sibremove(&p->children, pp);
+    adopt(initproc, pp);
   }
+  if (p->zombies == 0) return;
+  while ((pp = p->zombies) != 0) {
+    sibremove(&p->zombies, pp);
+    pp->parent = initproc;
+    sibadd(&initproc->zombies, pp);
+  }
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -301,6 +589,10 @@ void exit(int status) {
 
   if (p == initproc) panic("init exiting");
 
+  // Write back and unmap mmap()ed regions.
+  munmapall(p);
+  shmexit(p->pid);
+
   // Close all open files.
   for (int fd = 0; fd < NOFILE; fd++) {
     if (p->ofile[fd]) {
@@ -310,46 +602,33 @@ void exit(int status) {
     }
   }
 
+  if (p->exe) itextput(p->exe);
   begin_op();
   iput(p->cwd);
+  if (p->exe) iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
+  p->nseg = 0;
 
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
-  acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
-
-  // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
-
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
+  // Move to the parent's zombies, where wait() looks.
+  sibremove(&p->parent->children, p);
+  sibadd(&p->parent->zombies, p);
+
   // Parent might be sleeping in wait().
-  wakeup1(original_parent);
+  wakeup(p->parent);
+
+  acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&original_parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -360,57 +639,318 @@ void exit(int status) {
 // Return -1 if this process has no children.
 int wait(uint64 addr) {
   struct proc *np;
-  int havekids, pid;
+  int pid, xstate;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
-  // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for (;;) {
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for (np = proc; np < &proc[NPROC]; np++) {
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if (np->parent == p) {
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if (np->state == ZOMBIE) {
-          // Found one.
-          pid = np->pid;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate, sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
-          release(&np->lock);
-          release(&p->lock);
-          return pid;
-        }
-        release(&np->lock);
+    // exit() puts a child on p->zombies before it lets go
+    // of wait_lock, so only that list need be looked at.
+    if ((np = p->zombies) != 0) {
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&np->lock);
+      pid = np->pid;
+      xstate = np->xstate;
+      release(&np->lock);
+      // copyout() may have to read in a page of the
+      // program, so it can't run with spinlocks held.
+      // Only this process reaps its zombies, so np stays
+      // put meanwhile; if addr is bad, it is left for
+      // a later wait().
+      if (addr != 0) {
+        release(&wait_lock);
+        if (copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate)) < 0) return -1;
+        acquire(&wait_lock);
       }
+      acquire(&np->lock);
+      freeproc(np);
+      release(&np->lock);
+      release(&wait_lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if (!havekids || p->killed) {
-      release(&p->lock);
+    if (p->children == 0 || p->killed) {
+      release(&wait_lock);
       return -1;
     }
 
     // Wait for a child to exit.
-    sleep(p, &p->lock);  // DOC: wait-sleep
+    p->pageable = 1;
+    sleep(p, &wait_lock);  // DOC: wait-sleep
+    p->pageable = 0;
+  }
+}
+
+// The cpu with the least to do, for a new process to queue on:
+// the fewest processes queued, counting the one it is running.
+// Unlocked, so only a hint.
+static int leastbusy(void) {
+  struct cpu *c, *best = &cpus[0];
+  int load, min = -1;
+
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    if (!c->online) continue;
+    load = c->nrq + (c->proc != 0);
+    if (min < 0 || load < min) {
+      best = c;
+      min = load;
+    }
+  }
+  return best - cpus;
+}
+
+#ifdef SCHED_MLFQ
+// Multi-level feedback queue. A process starts at the top level
+// its nice value allows (see toplevel()) and drops a level each
+// time it uses up the time slice of the level it is on: MLFQSLICE
+// ticks at the top, twice as many at each level down. Sleeping
+// doesn't give it a fresh slice, so a process can't stay on top
+// by sleeping just before its slice runs out. Every MLFQBOOST
+// ticks all processes go back to their top levels, so that the
+// ones at the bottom don't starve. A cpu runs the processes on
+// the highest level it has queued, round robin, and a process
+// gives up its cpu at the next tick if one on a higher level is
+// waiting for it.
+
+// The highest level p may run at. Positive nice values
+// spread processes over the levels; negative ones are no
+// better than 0.
+static int toplevel(struct proc *p) { return p->nice <= 0 ? 0 : p->nice * NPRIO / (NICEMAX + 1); }
+
+// Ticks of time slice at level prio.
+#define SLICE(prio) (MLFQSLICE << (prio))
+
+// Every MLFQBOOST ticks, move every process to its top level.
+static void mlfqboost(void) {
+  struct proc *p, *q, *next, *all;
+  struct cpu *c;
+  uint now, bnext = boostnext;
+  int i;
+
+  acquire(&tickslock);
+  now = ticks;
+  release(&tickslock);
+  // one cpu at a time.
+  if (now < bnext || !__sync_bool_compare_and_swap(&boostnext, bnext, now + MLFQBOOST)) return;
+
+  acquire(&wait_lock);
+  for (p = allproc; p; p = p->allnext) {
+    acquire(&p->lock);
+    p->prio = toplevel(p);
+    p->slice = 0;
+    release(&p->lock);
+  }
+  release(&wait_lock);
+  // re-sort the queues, keeping processes in the order they
+  // were queued within each level.
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    acquire(&c->rqlock);
+    all = 0;
+    for (i = NQUEUE - 1; i >= 0; i--) {
+      if (c->rq[i].tail) {
+        c->rq[i].tail->rqnext = all;
+        all = c->rq[i].head;
+      }
+      c->rq[i].head = c->rq[i].tail = 0;
+    }
+    for (q = all; q; q = next) {
+      next = q->rqnext;
+      q->rqnext = 0;
+      // p->prio may be changing under setpriority(); the
+      // queue a process is on is only where it runs from.
+      i = q->prio;
+      if (c->rq[i].tail)
+        c->rq[i].tail->rqnext = q;
+      else
+        c->rq[i].head = q;
+      c->rq[i].tail = q;
+    }
+    release(&c->rqlock);
+  }
+}
+#endif
+
+#ifdef SCHED_CFS
+// Fair share. Each process's vruntime is the time it has run,
+// read from the time CSR (the CLINT's mtime), scaled by NICE0WEIGHT over the
+// weight of its nice value (see sched.h), so that a process with
+// twice the weight gets to run twice as long for the same
+// vruntime. A cpu keeps its queue as a heap ordered by vruntime
+// and always runs the process that is furthest behind; at each
+// tick the running process gives up the cpu if one queued there
+// is now further behind than it is. A process waking from a long
+// sleep is brought to within CFSSLEEP of the cpu's minvruntime,
+// so that it can't make up for all the time it slept at once,
+// and one that moves to another cpu keeps its distance from the
+// minvruntime of the cpu it left.
+//
+// The heap is a pairing heap, linked through the processes
+// themselves, so it needs no room for a fixed number of them.
+
+// Join heaps a and b, either of which may be empty,
+// and return the root.
+static struct proc *meld(struct proc *a, struct proc *b) {
+  struct proc *t;
+
+  if (a == 0) return b;
+  if (b == 0) return a;
+  if (b->vruntime < a->vruntime) {
+    t = a;
+    a = b;
+    b = t;
   }
+  b->hsib = a->hchild;
+  a->hchild = b;
+  return a;
+}
+
+// Add p to c's heap. Caller holds c->rqlock.
+static void rqput(struct cpu *c, struct proc *p) {
+  p->hchild = p->hsib = 0;
+  c->rq = meld(c->rq, p);
+}
+
+// Remove and return the process with the least vruntime from
+// c's non-empty heap. Caller holds c->rqlock.
+static struct proc *rqpop(struct cpu *c) {
+  struct proc *p = c->rq, *a, *b, *next, *pairs = 0;
+
+  // meld the root's children in pairs, left to right,
+  // then meld the pairs together, right to left.
+  for (a = p->hchild; a; a = next) {
+    b = a->hsib;
+    next = b ? b->hsib : 0;
+    a->hsib = 0;
+    if (b) b->hsib = 0;
+    a = meld(a, b);
+    a->hsib = pairs;
+    pairs = a;
+  }
+  c->rq = 0;
+  for (a = pairs; a; a = next) {
+    next = a->hsib;
+    a->hsib = 0;
+    c->rq = meld(c->rq, a);
+  }
+  p->hchild = 0;
+  return p;
+}
+#else
+// Add p to the tail of its level's queue on c.
+// Caller holds c->rqlock.
+static void rqput(struct cpu *c, struct proc *p) {
+  struct runq *q = &c->rq[p->prio];
+
+  p->rqnext = 0;
+  if (q->tail)
+    q->tail->rqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+}
+
+// Remove and return the process at the head of c's highest
+// non-empty queue. Caller holds c->rqlock, and c has one.
+static struct proc *rqpop(struct cpu *c) {
+  struct runq *q;
+  struct proc *p;
+
+  for (q = c->rq; q->head == 0; q++)
+    ;
+  p = q->head;
+  q->head = p->rqnext;
+  if (q->head == 0) q->tail = 0;
+  p->rqnext = 0;
+  return p;
+}
+#endif
+
+// Charge p for the time since it last started running or was
+// last charged. Caller holds p->lock.
+static void charge(struct proc *p) {
+  uint64 now = r_time(), d = now - p->runstart;
+
+  p->runtime += d;
+  p->runstart = now;
+#ifdef SCHED_CFS
+  p->vruntime += d * NICE0WEIGHT / niceweight[p->nice - NICEMIN];
+#endif
+}
+
+// Set up np's scheduling state. parent is the process that
+// created it, or 0 if none has yet.
+static void schednew(struct proc *np, struct proc *parent) {
+  np->nice = parent ? parent->nice : 0;
+  np->slice = 0;
+  np->runtime = 0;
+#ifdef SCHED_MLFQ
+  np->prio = toplevel(np);
+#else
+  np->prio = 0;
+#endif
+#ifdef SCHED_CFS
+  // level with the processes it will be queued with.
+  np->vruntime = cpus[np->cpu].minvruntime;
+#endif
+}
+
+// Make p RUNNABLE and put it on the run queue of the cpu it
+// last ran on, whose caches may still hold its state.
+// Caller holds p->lock, which keeps any cpu that takes p off the
+// queue from running it until p has stopped running here.
+void setrunnable(struct proc *p) {
+  struct cpu *c = &cpus[p->cpu];
+
+  if (!holding(&p->lock)) panic("setrunnable");
+  if (p->state == RUNNING) charge(p);  // yield()
+#ifdef SCHED_CFS
+  if (p->vruntime + CFSSLEEP < c->minvruntime) p->vruntime = c->minvruntime - CFSSLEEP;
+#endif
+  p->state = RUNNABLE;
+  acquire(&c->rqlock);
+  rqput(c, p);
+  c->nrq++;
+  release(&c->rqlock);
+}
+
+// Take the next process to run off c's run queue, or return 0.
+static struct proc *rqget(struct cpu *c) {
+  struct proc *p = 0;
+
+  acquire(&c->rqlock);
+  if (c->nrq > 0) {
+    p = rqpop(c);
+    c->nrq--;
+  }
+  release(&c->rqlock);
+  return p;
+}
+
+// Take a process from the longest run queue of another cpu,
+// for cpu c, which has nothing to run. Returns 0 if all the
+// queues are empty.
+static struct proc *steal(struct cpu *c) {
+  struct cpu *v, *busiest;
+  struct proc *p;
+
+  do {
+    busiest = 0;
+    for (v = cpus; v < &cpus[NCPU]; v++)
+      if (v != c && v->nrq > 0 && (busiest == 0 || v->nrq > busiest->nrq)) busiest = v;
+    if (busiest == 0) return 0;
+    // the owner may have emptied it since we looked.
+  } while ((p = rqget(busiest)) == 0);
+  c->nsteal++;
+  return p;
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process off this cpu's run queue, or off
+//    another's if this one's is empty.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -419,33 +959,59 @@ void scheduler(void) {
   struct cpu *c = mycpu();
 
   c->proc = 0;
+  c->online = 1;
   for (;;) {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    int found = 0;
-    for (p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if (p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
+    if ((p = rqget(c)) == 0 && (p = steal(c)) == 0) {
+      procreap();
+      kmem_cache_reap();
+      // nothing to run: pre-zero pages for kalloc_zeroed(),
+      // and only wait for an interrupt once the pool is full.
+      if (kzero_fill() == 0) {
+        intr_on();
+        asm volatile("wfi");
       }
-      release(&p->lock);
+      continue;
     }
-    if (found == 0) {
-      intr_on();
-      asm volatile("wfi");
+
+    // p may still be running on the cpu that queued it;
+    // that cpu's scheduler releases p->lock once it isn't.
+    acquire(&p->lock);
+    if (p->state != RUNNABLE) panic("scheduler");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+#ifdef SCHED_CFS
+    if (p->cpu != c - cpus) {
+      // keep p's distance from the minvruntime of the cpu it
+      // left, which may be behind it by up to CFSSLEEP.
+      long lag = (long)(p->vruntime - cpus[p->cpu].minvruntime);
+      if (lag < -CFSSLEEP) lag = -CFSSLEEP;
+      p->vruntime = lag < 0 && c->minvruntime < -lag ? 0 : c->minvruntime + lag;
     }
+    if (p->vruntime > c->minvruntime) c->minvruntime = p->vruntime;
+#endif
+    if (p->kstackgen > c->kstackgen) {
+      // p's stack may be in a slot whose old stack
+      // this cpu's TLB still has.
+      tlbflush();
+      c->kstackgen = p->kstackgen;
+    }
+    p->state = RUNNING;
+    p->cpu = c - cpus;
+    p->runstart = r_time();
+    c->proc = p;
+    c->nswitch++;
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+    kvmswitch(0);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -465,16 +1031,59 @@ void sched(void) {
   if (p->state == RUNNING) panic("sched running");
   if (intr_get()) panic("sched interruptible");
 
+  // yield() charged p before queueing it.
+  if (p->state != RUNNABLE) charge(p);
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
 
+// Called on each timer interrupt by the cpu running the
+// current process. Round robin gives up the cpu every tick;
+// MLFQ only when the process's time slice is used up, or
+// when a process of a higher level is waiting for this cpu;
+// CFS when a process queued for this cpu has had less.
+void schedtick(void) {
+#if defined(SCHED_CFS)
+  struct proc *p = myproc();
+  struct cpu *c;
+  int preempt;
+
+  acquire(&p->lock);
+  charge(p);
+  c = mycpu();
+  acquire(&c->rqlock);
+  preempt = c->nrq > 0 && c->rq->vruntime < p->vruntime;
+  release(&c->rqlock);
+  release(&p->lock);
+  if (!preempt) return;
+#elif defined(SCHED_MLFQ)
+  struct proc *p = myproc();
+  struct cpu *c;
+  int i, preempt = 0;
+
+  mlfqboost();
+  acquire(&p->lock);
+  if (++p->slice >= SLICE(p->prio)) {
+    if (p->prio < NQUEUE - 1) p->prio++;
+    p->slice = 0;
+    preempt = 1;
+  }
+  // unlocked; a process queued meanwhile waits a tick.
+  c = mycpu();
+  for (i = 0; i < p->prio; i++)
+    if (c->rq[i].head) preempt = 1;
+  release(&p->lock);
+  if (!preempt) return;
+#endif
+  yield();
+}
+
 // Give up the CPU for one scheduling round.
 void yield(void) {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -498,6 +1107,49 @@ void forkret(void) {
   usertrapret();
 }
 
+static struct waitq *wqfor(void *chan) { return &waitq[((uint64)chan >> 2) % NWAITQ]; }
+
+// Put p at the tail of the queue for p->chan.
+// Caller holds p->lock.
+static void wqadd(struct proc *p) {
+  struct waitq *q = wqfor(p->chan);
+
+  acquire(&q->lock);
+  p->wqnext = 0;
+  p->wqprev = q->tail;
+  if (q->tail)
+    q->tail->wqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  p->onwq = 1;
+  release(&q->lock);
+}
+
+// Take p off q. Caller holds q->lock.
+static void wqremove(struct waitq *q, struct proc *p) {
+  if (p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    q->head = p->wqnext;
+  if (p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  else
+    q->tail = p->wqprev;
+  p->wqnext = p->wqprev = 0;
+  p->onwq = 0;
+}
+
+// Take sleeping p off its wait queue, if a wakeup
+// hasn't already. Caller holds p->lock.
+static void unsleep(struct proc *p) {
+  struct waitq *q = wqfor(p->chan);
+
+  acquire(&q->lock);
+  if (p->onwq) wqremove(q, p);
+  release(&q->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk) {
@@ -505,18 +1157,20 @@ void sleep(void *chan, struct spinlock *lk) {
 
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once p is on chan's wait queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup looks there, then locks p->lock),
   // so it's okay to release lk.
   if (lk != &p->lock) {  // DOC: sleeplock0
     acquire(&p->lock);   // DOC: sleeplock1
-    release(lk);
   }
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  wqadd(p);
+
+  if (lk != &p->lock) release(lk);
 
   sched();
 
@@ -530,27 +1184,64 @@ void sleep(void *chan, struct spinlock *lk) {
   }
 }
 
-// Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
-void wakeup(void *chan) {
-  struct proc *p;
+// Wake up the processes sleeping on chan: all of them, or just
+// the one that has slept longest. Takes them off chan's queue,
+// then wakes each one that is still asleep on chan once it can
+// lock it; one that kill() woke meanwhile, and that went back
+// to sleep on chan, gets a spurious wakeup.
+static void wake(void *chan, int all) {
+  struct waitq *q = wqfor(chan);
+  struct proc *p, *next, *woken[WAKEBATCH];
+  struct cpu *c;
+  int i, n;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+  push_off();
+  c = mycpu();
+  c->waking++;
+  do {
+    n = 0;
+    acquire(&q->lock);
+    for (p = q->head; p && n < (all ? WAKEBATCH : 1); p = next) {
+      next = p->wqnext;
+      if (p->chan == chan) {
+        wqremove(q, p);
+        woken[n++] = p;
+      }
     }
-    release(&p->lock);
-  }
+    release(&q->lock);
+    for (i = 0; i < n; i++) {
+      p = woken[i];
+      acquire(&p->lock);
+      if (p->state == SLEEPING && p->chan == chan) {
+        unsleep(p);
+        setrunnable(p);
+      }
+      release(&p->lock);
+    }
+  } while (all && n == WAKEBATCH);
+  __atomic_store_n(&c->waking, c->waking - 1, __ATOMIC_RELEASE);
+  pop_off();
 }
 
-// Wake up p if it is sleeping in wait(); used by exit().
-// Caller must hold p->lock.
-static void wakeup1(struct proc *p) {
-  if (!holding(&p->lock)) panic("wakeup1");
-  if (p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
-  }
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void wakeup(void *chan) { wake(chan, 1); }
+
+// Wake up the process that has slept longest on chan, for
+// when only one sleeper can go ahead, such as a sleeplock's.
+// The one woken must pass the wakeup on if it doesn't use it.
+// Must be called without any p->lock.
+void wakeup_one(void *chan) { wake(chan, 0); }
+
+// Lock and return the process with the given pid, or 0
+// if there is none.
+static struct proc *pidlock(int pid) {
+  struct proc *p;
+
+  acquire(&wait_lock);
+  if ((p = pidlookup(pid)) != 0) acquire(&p->lock);
+  release(&wait_lock);
+  return p;
 }
 
 // Kill the process with the given pid.
@@ -559,20 +1250,35 @@ static void wakeup1(struct proc *p) {
 int kill(int pid) {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->pid == pid) {
-      p->killed = 1;
-      if (p->state == SLEEPING) {
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if ((p = pidlock(pid)) == 0) return -1;
+  p->killed = 1;
+  if (p->state == SLEEPING) {
+    // Wake process from sleep().
+    unsleep(p);
+    setrunnable(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
+}
+
+// Set the nice value of the process with the given pid, or of
+// the current process if pid is 0: from NICEMIN, for the most
+// cpu, to NICEMAX, for the least. Children inherit it.
+// Returns 0, or -1 if there's no such process or nice is out
+// of range.
+int setpriority(int pid, int nice) {
+  struct proc *p;
+
+  if (nice < NICEMIN || nice > NICEMAX) return -1;
+  if (pid == 0) pid = myproc()->pid;
+  if ((p = pidlock(pid)) == 0) return -1;
+  p->nice = nice;
+#ifdef SCHED_MLFQ
+  // a lower nice value waits for the next boost.
+  if (p->prio < toplevel(p)) p->prio = toplevel(p);
+#endif
+  release(&p->lock);
+  return 0;
 }
 
 // Copy to either a user address, or kernel address,
@@ -601,23 +1307,125 @@ int either_copyin(void *dst, int user_src, uint64 src, uint64 len) {
   }
 }
 
+// The number of processes in use.
+int procused(void) { return nused; }
+
+// Lock and return the process in use with the least pid >= pid,
+// or, if there is none, the one with the least pid; 0 if there
+// are no processes. For walking them all without holding a lock
+// from one to the next, as swapreclaim() and procinfo() do.
+struct proc *proclock(int pid) {
+  struct proc *p;
+
+  acquire(&wait_lock);
+  // a walk asks for the pid after the one it was at,
+  // so that one, if it is still there, is a short cut.
+  if ((p = pidlookup(pid)) == 0) {
+    if ((p = pidlookup(pid - 1)) != 0)
+      p = p->allnext;
+    else
+      for (p = allproc; p && p->pid < pid; p = p->allnext)
+        ;
+  }
+  if (p == 0) p = allproc;
+  if (p) acquire(&p->lock);
+  release(&wait_lock);
+  return p;
+}
+
+// Scheduler counters, summed over the cpus: how many are
+// running, how many times they switched to a process, and
+// how many of those processes came off another cpu's queue.
+void schedstat(uint64 *ncpu, uint64 *nswitch, uint64 *nsteal) {
+  struct cpu *c;
+
+  *ncpu = *nswitch = *nsteal = 0;
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    *ncpu += c->online;
+    *nswitch += c->nswitch;
+    *nsteal += c->nsteal;
+  }
+}
+
+// Copy a struct procinfo for each process in use, up to n of
+// them, to user address addr. Returns how many, or -1 if addr
+// is bad.
+int procinfo(uint64 addr, int n) {
+  struct procinfo pi;
+  struct proc *p;
+  int i = 0, pid = 0;
+
+  while (i < n && (p = proclock(pid + 1)) != 0) {
+    if (p->pid <= pid) {  // wrapped around
+      release(&p->lock);
+      break;
+    }
+    pid = p->pid;
+    // a USED process's page table may be under construction.
+    if (p->state == USED || p->pagetable == 0) {
+      release(&p->lock);
+      continue;
+    }
+    pi.pid = p->pid;
+    pi.state = p->state;
+    pi.sz = p->sz;
+    pi.wss = p->wss;
+    pi.nice = p->nice;
+    pi.prio = p->prio;
+    pi.runtime = p->runtime;
+    safestrcpy(pi.name, p->name, sizeof(pi.name));
+    // p->pagetable can't be freed while p->lock is held;
+    // exec() only frees the old one after replacing it.
+    uvmstat(p->pagetable, &pi);
+    release(&p->lock);
+    if (copyout(myproc()->pagetable, addr + i * sizeof(pi), (char *)&pi, sizeof(pi)) < 0) return -1;
+    i++;
+  }
+  return i;
+}
+
+// Every WSTICKS ticks, sample the working sets of the processes
+// that aren't running on other cpus: the pages each has used
+// since its last sample (see uvmsample()). swapreclaim() spares
+// processes that use all of their memory, and procinfo()
+// reports it. Called by usertrap() on timer interrupts.
+void wssample(void) {
+  struct proc *me = myproc(), *p;
+  uint now, next = wsnext;
+
+  acquire(&tickslock);
+  now = ticks;
+  release(&tickslock);
+  // one cpu at a time.
+  if (now < next || !__sync_bool_compare_and_swap(&wsnext, next, now + WSTICKS)) return;
+
+  acquire(&wait_lock);
+  for (p = allproc; p; p = p->allnext) {
+    acquire(&p->lock);
+    if (p->pagetable != 0 && (p == me || p->state == RUNNABLE || p->state == SLEEPING)) uvmsample(p);
+    release(&p->lock);
+  }
+  release(&wait_lock);
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
 void procdump(void) {
   static char *states[] = {
-      [UNUSED] "unused", [SLEEPING] "sleep ", [RUNNABLE] "runble", [RUNNING] "run   ", [ZOMBIE] "zombie"};
+      [UNUSED] "unused", [USED] "used  ", [SLEEPING] "sleep ", [RUNNABLE] "runble", [RUNNING] "run   ", [ZOMBIE] "zombie"};
   struct proc *p;
   char *state;
+  int n;
 
   printf("\n");
-  for (p = proc; p < &proc[NPROC]; p++) {
-    if (p->state == UNUSED) continue;
+  for (p = allproc; p; p = p->allnext) {
     if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    if (p->pagetable && (n = uvmmegapages(p->pagetable)) > 0) printf(" %d megapages", n);
     printf("\n");
   }
 }
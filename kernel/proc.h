@@ -18,12 +18,51 @@ struct context {
   uint64 s11;
 };
 
+struct run;
+
+// A cpu has a queue of RUNNABLE processes for each priority
+// level of the scheduling policy (see proc.c).
+#ifdef SCHED_MLFQ
+#define NQUEUE NPRIO
+#else
+#define NQUEUE 1
+#endif
+
+struct runq {
+  struct proc *head;  // next to run; linked through p->rqnext
+  struct proc *tail;
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+
+  // kalloc.c's per-CPU cache of free pages.
+  struct spinlock pglock;     // protects pgcache; held by thieves too
+  struct run *pgcache;        // free pages owned by this cpu
+  int npgcache;               // number of pages on pgcache
+
+  uint64 asidgen;             // ASID generation this cpu's TLB is clean for
+  uint64 kstackgen;           // kernel stack generation this cpu's TLB is clean for (see newproc())
+  int waking;                 // wake()s under way on this cpu (see procreap())
+  uint64 ntlbflush;           // sfence.vma of the whole TLB (see tlbflush())
+  uint64 ntlbflushasid;       // sfence.vma of one ASID's entries
+
+  // proc.c's queues of RUNNABLE processes waiting for this cpu.
+  struct spinlock rqlock;     // protects rq[] and nrq
+#ifdef SCHED_CFS
+  struct proc *rq;            // a pairing heap on p->vruntime
+  uint64 minvruntime;         // vruntime of the process run last; never decreases
+#else
+  struct runq rq[NQUEUE];     // highest priority first
+#endif
+  int nrq;                    // number of processes on the queues
+  int online;                 // has entered scheduler()
+  uint64 nswitch;             // processes this cpu has switched to
+  uint64 nsteal;              // of those, ones taken from another cpu's queue
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,27 +119,83 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+
+// A loadable segment of the program image. exec() maps none of
+// it; pages are read from p->exe on first touch (see loadpage()).
+struct seg {
+  uint64 va;      // page-aligned start
+  uint64 filesz;  // bytes read from the file; the rest is zero
+  uint64 memsz;
+  uint off;       // file offset of va
+  int perm;       // PTE_R, PTE_W, PTE_X and PTE_U, from the ELF flags
+};
+
+// A region of memory mapped by mmap(). Its pages are
+// allocated on first touch (see lazyfault()).
+struct vma {
+  uint64 addr;     // page-aligned start
+  uint64 len;      // a multiple of PGSIZE; 0 if the slot is free
+  int prot;        // PROT_READ &c
+  int flags;       // MAP_SHARED or MAP_PRIVATE, and MAP_ANONYMOUS
+  struct file *f;  // file mapped; 0 if anonymous
+  uint64 off;      // file offset of addr
+  struct shm *shm; // shared-memory segment attached; 0 if none
+};
 
 // Per-process state
 struct proc {
   struct spinlock lock;
 
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process
+  struct proc *children;       // Live children, linked through sibnext
+  struct proc *zombies;        // Children that have exited, ditto
+  struct proc *sibnext;        // Links on parent's children or zombies
+  struct proc *sibprev;
+  struct proc *allnext;        // Links on the list of processes in use, in pid order
+  struct proc *allprev;
+  struct proc *pidnext;        // Next in p->pid's hash chain
+
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *wqnext;         // Links on chan's wait queue; protected by its lock
+  struct proc *wqprev;
+  int onwq;                    // Whether p is on that wait queue
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int pageable;                // Stopped where swapreclaim() may take its pages
+  uint64 wss;                  // Pages used in the last working-set sample (see wssample())
+  uint64 wsrss;                // Pages resident at the last working-set sample
+  int cpu;                     // Cpu whose run queue p goes on when RUNNABLE
+  struct proc *rqnext;         // Next on that run queue; protected by its rqlock
+  struct proc *hchild;         // CFS: first child in that cpu's heap; ditto
+  struct proc *hsib;           // CFS: next sibling in the heap; ditto
+  int nice;                    // NICEMIN..NICEMAX; higher gets less cpu (see setpriority())
+  int prio;                    // Run queue level, 0 (highest) to NQUEUE-1
+  int slice;                   // Ticks used of the time slice at level prio
+  uint64 vruntime;             // CFS: running time weighted by nice, in mtime cycles
+  uint64 runtime;              // Running time, in mtime cycles
+  uint64 runstart;             // mtime when p last started running or was charged
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
+  uint64 kstackgen;            // Kernel stack generation when kstack was mapped
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, mapping user memory too
+  uint64 asid;                 // ASID generation and ASID of pagetable; 0 if none
+  int asidcpu;                 // cpu that last ran this process in user space; -1 to flush anywhere
   struct trapframe *trapframe; // data page for trampoline.S
+  int ucopyerr;                // copyin_new() hit a page it couldn't fault in
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program image, for paging in
+  struct seg seg[NSEG];        // Program segments backed by exe
+  int nseg;
+  struct vma vma[NVMA];        // Regions mapped by mmap()
   char name[16];               // Process name (debugging)
 };
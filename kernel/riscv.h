@@ -40,6 +40,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User memory
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -197,7 +198,12 @@ w_pmpaddr0(uint64 x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+// satp bits 44..59 hold the address-space identifier (ASID)
+// that tags the TLB entries loaded through this page table.
+#define SATP_ASID_SHIFT 44
+#define ASIDMASK 0xFFFFL
+
+#define MAKE_SATP(pagetable, asid) (SATP_SV39 | ((uint64)(asid) << SATP_ASID_SHIFT) | (((uint64)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -332,6 +338,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -339,11 +352,23 @@ sfence_vma()
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+// a leaf PTE in a level-1 page table maps a 2-megabyte megapage.
+#define MEGAPGSIZE (PGSIZE*512)
+#define MEGAPGROUNDUP(sz)  (((sz)+MEGAPGSIZE-1) & ~(MEGAPGSIZE-1))
+#define MEGAPGROUNDDOWN(a) (((a)) & ~(MEGAPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6) // accessed: used since the bit was last cleared
+#define PTE_D (1L << 7) // dirty: written to since it was mapped
+#define PTE_COW (1L << 8) // RSW: copy-on-write page, writable once copied
+#define PTE_SWAP (1L << 9) // RSW: invalid PTE of a page that is in swap slot PTE2SWAP(pte)
+#define PTE_REF (1L << 9)  // RSW: valid PTE whose PTE_A was cleared by the kernel but not yet seen by pgaccess()
+
+#define PTE_SWAPPED(pte) (((pte) & (PTE_V|PTE_SWAP)) == PTE_SWAP)
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -352,6 +377,14 @@ sfence_vma()
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a swapped-out page's PTE holds its swap slot where the PPN would be.
+#define SWAP2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SWAP(pte) ((pte) >> 10)
+
+// a valid PTE with any of R, W, X set is a leaf;
+// otherwise it points to a lower-level page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
@@ -0,0 +1,15 @@
+// Weights of the nice values NICEMIN..NICEMAX for the fair-share
+// scheduler (see proc.c), the same as Linux's: one step of nice
+// is worth about 10% of the cpu next to a process one step away.
+#define NICE0WEIGHT 1024
+
+static const int niceweight[NICEMAX - NICEMIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
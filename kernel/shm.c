@@ -0,0 +1,161 @@
+//
+// Shared-memory segments, for passing data between processes
+// without copying it.
+//
+// shmget() finds or creates a segment by key; shmat() maps it
+// into a process (see mmap.c), and every process that attaches
+// it maps the same physical pages. A segment's pages are
+// allocated when first touched. The segment holds a reference
+// to each of them, and each mapping holds another. The process
+// that creates a segment holds it as if attached until it first
+// attaches it (see shmclaim()) or exits, so that a segment no
+// one ever attaches doesn't keep its slot. The segment goes
+// away, with its pages, when the last process attached to it
+// detaches with shmdt(), exits, or execs.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+
+struct shm {
+  int key;         // 0 for a private segment
+  int nattach;     // mappings of the segment, and the creator's hold
+  int creator;     // pid holding the segment until it attaches; 0 if none
+  uint64 npages;   // 0 if the slot is free
+  int order;       // kalloc_pages() order of pages[]
+  char **pages;    // npages pages; 0 until first touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void shminit(void) { initlock(&shmtab.lock, "shm"); }
+
+// Return the id of the segment with key, creating it with
+// size bytes if there isn't one. Key 0 always creates a new
+// segment, which only the processes that attach it and their
+// children can reach. Returns -1 if an existing segment is
+// smaller than size, or if no segment can be made.
+int shmget(int key, uint64 size) {
+  struct shm *s, *free = 0;
+  uint64 npages = PGROUNDUP(size) / PGSIZE;
+  int order;
+
+  if (size == 0 || size > MAXUVA) return -1;
+
+  acquire(&shmtab.lock);
+  for (s = shmtab.shm; s < &shmtab.shm[NSHM]; s++) {
+    if (s->npages == 0) {
+      if (free == 0) free = s;
+    } else if (key != 0 && s->key == key) {
+      release(&shmtab.lock);
+      return s->npages < npages ? -1 : s - shmtab.shm;
+    }
+  }
+  for (order = 0; (PGSIZE << order) / sizeof(char *) < npages; order++)
+    ;
+  if (free == 0 || (free->pages = (char **)kalloc_pages(order)) == 0) {
+    release(&shmtab.lock);
+    return -1;
+  }
+  memset(free->pages, 0, PGSIZE << order);
+  free->key = key;
+  free->nattach = 1;
+  free->creator = myproc()->pid;
+  free->npages = npages;
+  free->order = order;
+  release(&shmtab.lock);
+  return free - shmtab.shm;
+}
+
+// Take a new attachment of segment id, returning the segment and
+// setting *size to its size, or return 0 if there's no such segment.
+struct shm *shmattach(int id, uint64 *size) {
+  struct shm *s;
+
+  if (id < 0 || id >= NSHM) return 0;
+  s = &shmtab.shm[id];
+  acquire(&shmtab.lock);
+  if (s->npages == 0) {
+    release(&shmtab.lock);
+    return 0;
+  }
+  s->nattach++;
+  *size = s->npages * PGSIZE;
+  release(&shmtab.lock);
+  return s;
+}
+
+// The current process has attached s, with an attachment
+// that shmattach() took. If it created s, the attachment
+// takes over its hold. Called once the attachment is in
+// place, so that a failed shmat() leaves the hold alone.
+void shmclaim(struct shm *s) {
+  acquire(&shmtab.lock);
+  if (s->creator == myproc()->pid) {
+    s->creator = 0;
+    s->nattach--;  // never to 0: the attachment remains
+  }
+  release(&shmtab.lock);
+}
+
+// Take another attachment of s, for fork().
+struct shm *shmdup(struct shm *s) {
+  acquire(&shmtab.lock);
+  s->nattach++;
+  release(&shmtab.lock);
+  return s;
+}
+
+// Return page i of segment s, with a new reference for the
+// caller's mapping. Allocates the page, zeroed, if no one has
+// touched it. Returns 0 if out of memory.
+char *shmpage(struct shm *s, uint64 i) {
+  char *mem;
+
+  acquire(&shmtab.lock);
+  if (i >= s->npages) panic("shmpage");
+  if (s->pages[i] == 0) s->pages[i] = kalloc_zeroed();
+  if ((mem = s->pages[i]) != 0) kdup(mem);
+  release(&shmtab.lock);
+  return mem;
+}
+
+// Free segment s and its pages. Caller holds shmtab.lock.
+static void shmfree(struct shm *s) {
+  for (uint64 i = 0; i < s->npages; i++)
+    if (s->pages[i]) kfree(s->pages[i]);
+  kfree_pages(s->pages, s->order);
+  s->pages = 0;
+  s->npages = 0;
+}
+
+// Drop an attachment of segment s, freeing the segment
+// if it was the last one.
+void shmput(struct shm *s) {
+  acquire(&shmtab.lock);
+  if (--s->nattach == 0) shmfree(s);
+  release(&shmtab.lock);
+}
+
+// Drop the holds of the exiting process pid on the
+// segments it created but never attached.
+void shmexit(int pid) {
+  struct shm *s;
+
+  acquire(&shmtab.lock);
+  for (s = shmtab.shm; s < &shmtab.shm[NSHM]; s++) {
+    if (s->npages != 0 && s->creator == pid) {
+      s->creator = 0;
+      if (--s->nattach == 0) shmfree(s);
+    }
+  }
+  release(&shmtab.lock);
+}
@@ -0,0 +1,208 @@
+// Object caches for small, fixed-size kernel objects
+// (pipes, open files, in-memory inodes), built on kalloc().
+//
+// Each cache carves whole pages ("slabs") into equal-sized
+// objects. A slab starts with a struct slab header; the page
+// holding an object is found by rounding the object's address
+// down to a page boundary. Slabs with free objects are kept on
+// the cache's partial list; a slab whose objects are all free
+// again goes back to kalloc().
+//
+// In front of the slabs each CPU has a magazine: a small stack
+// of free objects that kmem_cache_alloc()/kmem_cache_free() use
+// with interrupts off and without taking the cache lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NCACHE 16   // maximum number of object caches
+#define MAGSIZE 16  // objects in a per-CPU magazine
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;  // partial list
+  struct slab *prev;
+  struct obj *free;   // free objects in this slab
+  int inuse;          // allocated objects, including those in magazines
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;               // object size, rounded up
+  int perslab;             // objects per slab
+  struct slab *partial;    // slabs with at least one free object
+  int nslab;               // slabs currently allocated
+  struct {
+    int n;
+    void *objs[MAGSIZE];
+  } mag[NCPU];             // per-CPU magazines, touched with intr off
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabs;
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+void slabinit(void) { initlock(&slabs.lock, "slabs"); }
+
+// Create a cache of objects of the given size.
+// Caches live for the lifetime of the kernel.
+struct kmem_cache *kmem_cache_create(char *name, uint size) {
+  struct kmem_cache *c;
+
+  size = (size + 15) & ~15;
+  if (size < sizeof(struct obj) || size > PGSIZE - SLABHDR) panic("kmem_cache_create: size");
+
+  acquire(&slabs.lock);
+  if (slabs.n >= NCACHE) panic("kmem_cache_create: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->partial = 0;
+  c->nslab = 0;
+  for (int i = 0; i < NCPU; i++) c->mag[i].n = 0;
+  return c;
+}
+
+static void partial_push(struct kmem_cache *c, struct slab *s) {
+  s->prev = 0;
+  s->next = c->partial;
+  if (c->partial) c->partial->prev = s;
+  c->partial = s;
+}
+
+static void partial_remove(struct kmem_cache *c, struct slab *s) {
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+// Carve a fresh page into objects.
+// Returns 0 if out of memory.
+static struct slab *newslab(struct kmem_cache *c) {
+  struct slab *s;
+  char *o;
+  int i;
+
+  if ((s = (struct slab *)kalloc()) == 0) return 0;
+  s->cache = c;
+  s->free = 0;
+  s->inuse = 0;
+  o = (char *)s + SLABHDR;
+  for (i = 0; i < c->perslab; i++, o += c->size) {
+    ((struct obj *)o)->next = s->free;
+    s->free = (struct obj *)o;
+  }
+  return s;
+}
+
+// Return an object to its slab.
+// Caller holds c->lock.
+static void slab_put(struct kmem_cache *c, void *v) {
+  struct slab *s = (struct slab *)PGROUNDDOWN((uint64)v);
+  struct obj *o = (struct obj *)v;
+
+  if (s->cache != c) panic("kmem_cache_free: wrong cache");
+  if (s->free == 0) partial_push(c, s);  // was full
+  o->next = s->free;
+  s->free = o;
+  if (--s->inuse == 0) {
+    partial_remove(c, s);
+    c->nslab--;
+    kfree((void *)s);
+  }
+}
+
+// Move up to n objects from the slabs onto the magazine
+// stack objs, whose depth is *np.
+// Caller holds c->lock.
+static void slab_fill(struct kmem_cache *c, int *np, void **objs, int n) {
+  struct slab *s;
+  struct obj *o;
+
+  while (n > 0 && (s = c->partial) != 0) {
+    o = s->free;
+    s->free = o->next;
+    s->inuse++;
+    if (s->free == 0) partial_remove(c, s);
+    objs[(*np)++] = o;
+    n--;
+  }
+}
+
+// Allocate an object. Its contents are undefined.
+// Returns 0 if out of memory.
+void *kmem_cache_alloc(struct kmem_cache *c) {
+  struct slab *s;
+  void *v = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if (c->mag[id].n == 0) {
+    acquire(&c->lock);
+    slab_fill(c, &c->mag[id].n, c->mag[id].objs, MAGSIZE / 2);
+    if (c->mag[id].n == 0 && (s = newslab(c)) != 0) {
+      c->nslab++;
+      partial_push(c, s);
+      slab_fill(c, &c->mag[id].n, c->mag[id].objs, MAGSIZE / 2);
+    }
+    release(&c->lock);
+  }
+  if (c->mag[id].n > 0) v = c->mag[id].objs[--c->mag[id].n];
+  pop_off();
+  return v;
+}
+
+// Free an object returned by kmem_cache_alloc(c).
+void kmem_cache_free(struct kmem_cache *c, void *v) {
+  int id;
+
+  push_off();
+  id = cpuid();
+  if (c->mag[id].n == MAGSIZE) {
+    // magazine full: return half of it to the slabs.
+    acquire(&c->lock);
+    while (c->mag[id].n > MAGSIZE / 2) slab_put(c, c->mag[id].objs[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  c->mag[id].objs[c->mag[id].n++] = v;
+  pop_off();
+}
+
+// Return the objects in this CPU's magazines to their slabs,
+// so that empty slabs go back to kalloc(). Called by an idle
+// CPU; objects parked in magazines would otherwise pin pages.
+void kmem_cache_reap(void) {
+  struct kmem_cache *c;
+  int id;
+
+  push_off();
+  id = cpuid();
+  for (c = slabs.cache; c < &slabs.cache[slabs.n]; c++) {
+    if (c->mag[id].n == 0) continue;
+    acquire(&c->lock);
+    while (c->mag[id].n > 0) slab_put(c, c->mag[id].objs[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  pop_off();
+}
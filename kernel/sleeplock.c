@@ -30,7 +30,8 @@ void releasesleep(struct sleeplock *lk) {
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  // only one waiter can have the lock.
+  wakeup_one(lk);
   release(&lk->lk);
 }
 
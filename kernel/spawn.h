@@ -0,0 +1,13 @@
+// File actions for spawn(), applied in order to the child's
+// copies of the parent's file descriptors.
+#define SPAWN_END 0    // no more actions
+#define SPAWN_DUP2 1   // make newfd refer to fd's file, closing it first
+#define SPAWN_CLOSE 2  // close fd
+
+#define MAXSPAWNFA 32  // most actions in a list, besides SPAWN_END
+
+struct spawnfa {
+  int op;
+  int fd;
+  int newfd;
+};
@@ -16,8 +16,14 @@ uint64 mscratch0[NCPU * 32];
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
+// physical address of the device tree the boot loader
+// passed, for main() to find memory in (see dtb.c).
+uint64 dtbpa;
+
 // entry.S jumps here in machine mode on stack0.
-void start() {
+void start(uint64 dtb) {
+  if (r_mhartid() == 0) dtbpa = dtb;
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
@@ -44,6 +50,11 @@ void start() {
   // ask for clock interrupts.
   timerinit();
 
+  // let supervisor mode read mtime through the time CSR
+  // (r_time()); the CLINT isn't in processes' kernel page
+  // tables.
+  w_mcounteren(r_mcounteren() | 2);
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
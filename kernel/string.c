@@ -22,6 +22,11 @@ int memcmp(const void *v1, const void *v2, uint n) {
   return 0;
 }
 
+// memmove() and strnmove() move 8-byte words where they can.
+#define ONES 0x0101010101010101L
+#define HIGHS 0x8080808080808080L
+#define HASZERO(w) ((((w) - ONES) & ~(w)) & HIGHS)  // does word w have a zero byte?
+
 void *memmove(void *dst, const void *src, uint n) {
   const char *s;
   char *d;
@@ -31,13 +36,51 @@ void *memmove(void *dst, const void *src, uint n) {
   if (s < d && s + n > d) {
     s += n;
     d += n;
+    if ((uint64)s % 8 == (uint64)d % 8) {
+      while (n > 0 && (uint64)s % 8 != 0) n--, *--d = *--s;
+      for (; n >= 8; n -= 8) {
+        s -= 8;
+        d -= 8;
+        *(uint64 *)d = *(const uint64 *)s;
+      }
+    }
     while (n-- > 0) *--d = *--s;
-  } else
+  } else {
+    // words only if s and d can be aligned together.
+    if ((uint64)s % 8 == (uint64)d % 8) {
+      while (n > 0 && (uint64)s % 8 != 0) n--, *d++ = *s++;
+      for (; n >= 8; n -= 8, s += 8, d += 8) *(uint64 *)d = *(const uint64 *)s;
+    }
     while (n-- > 0) *d++ = *s++;
+  }
 
   return dst;
 }
 
+// Copy the string src to dst, '\0' included, but no more than
+// n bytes. Returns the length of the string, or n if there's
+// no '\0' in the first n bytes. Looks for the '\0' a word at a
+// time, so it may read up to 7 bytes of src past it, though
+// never past n.
+uint64 strnmove(char *dst, const char *src, uint64 n) {
+  uint64 i, w;
+  int k;
+
+  for (i = 0; i < n && (uint64)(src + i) % 8 != 0; i++)
+    if ((dst[i] = src[i]) == '\0') return i;
+  for (; n - i >= 8; i += 8) {
+    w = *(const uint64 *)(src + i);
+    if (HASZERO(w)) break;
+    if ((uint64)(dst + i) % 8 == 0)
+      *(uint64 *)(dst + i) = w;
+    else
+      for (k = 0; k < 8; k++, w >>= 8) dst[i + k] = w;  // little-endian
+  }
+  for (; i < n; i++)
+    if ((dst[i] = src[i]) == '\0') return i;
+  return n;
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void *memcpy(void *dst, const void *src, uint n) { return memmove(dst, src, n); }
 
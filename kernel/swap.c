@@ -0,0 +1,206 @@
+//
+// Paging user memory out to the swap area of the disk, so that
+// a workload that needs more memory than the machine has gets
+// slower rather than failing.
+//
+// When kalloc() runs out and its caller can sleep, it asks
+// swapreclaim() for pages. swapreclaim() runs the clock
+// algorithm over the 4096-byte pages of processes' memory
+// (see uvmevict()): a page the hardware has marked PTE_A since
+// the hand last passed gets its bit cleared and another chance;
+// one that hasn't is written to a free slot of the swap area
+// and freed, and its PTE, now invalid, records the slot with
+// PTE_SWAP. A later fault on the page reads it back in
+// (see lazyfault()).
+//
+// A slot has a reference count, like a page: fork() shares a
+// swapped-out page's slot with the child rather than reading
+// the page in, and whoever reads it back first gets a copy.
+//
+// The hand only takes pages from the process that needs memory
+// and from processes that are stopped where their kernel code
+// isn't using their memory (p->pageable), so no one can be
+// holding the physical address of a page that goes. On its
+// first turn it also passes over processes whose last working-
+// set sample found them using every page they had resident
+// (see wssample()).
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+
+#define BPP (PGSIZE / BSIZE)  // blocks per page
+#define NSLOT (SWAPSIZE / BPP)
+#define SWAPBATCH 16  // pages swapreclaim() tries to free at once
+
+struct {
+  struct spinlock lock;  // protects ref[] and nfree
+  uchar ref[NSLOT];      // references to each slot; 0 if free
+  uint nslot;            // slots in the swap area
+  uint nfree;            // slots with no references
+  uint next;             // where swapalloc() looks first
+
+  // held while reclaiming or reading in, so a page is
+  // never read from a slot that is still being written.
+  struct sleeplock iolock;
+  struct buf buf;  // for the disk transfers
+  uint dev;
+  uint start;
+
+  // the clock hand.
+  int hpid;    // pid of the process it is at, or of the next one
+  uint64 hva;  // next address to look at there
+} swap;
+
+// Use the swap area the superblock of dev describes, if any.
+void swapinit(int dev, struct superblock *sb) {
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  swap.dev = dev;
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / BPP;
+  if (swap.nslot > NSLOT) swap.nslot = NSLOT;
+  swap.nfree = swap.nslot;
+}
+
+// Allocate a free slot, with one reference.
+// Returns -1 if the swap area is full.
+int swapalloc(void) {
+  uint i, s;
+
+  acquire(&swap.lock);
+  for (i = 0; swap.nfree > 0 && i < swap.nslot; i++) {
+    s = (swap.next + i) % swap.nslot;
+    if (swap.ref[s] == 0) {
+      swap.ref[s] = 1;
+      swap.nfree--;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Add a reference to slot, for fork().
+void swapdup(uint slot) {
+  acquire(&swap.lock);
+  if (slot >= swap.nslot || swap.ref[slot] == 0 || swap.ref[slot] == 255) panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot, freeing it if that was the last.
+void swapfree(uint slot) {
+  acquire(&swap.lock);
+  if (slot >= swap.nslot || swap.ref[slot] == 0) panic("swapfree");
+  if (--swap.ref[slot] == 0) swap.nfree++;
+  release(&swap.lock);
+}
+
+// Bytes of free swap space.
+uint64 swapfreemem(void) { return (uint64)swap.nfree * PGSIZE; }
+
+// Copy the page at pa to or from slot, one block at a time.
+// Caller holds swap.iolock.
+static void swapio(uint slot, char *pa, int write) {
+  for (int i = 0; i < BPP; i++) {
+    swap.buf.dev = swap.dev;
+    swap.buf.blockno = swap.start + slot * BPP + i;
+    if (write) memmove(swap.buf.data, pa + i * BSIZE, BSIZE);
+    virtio_disk_rw(&swap.buf, write);
+    if (!write) memmove(pa + i * BSIZE, swap.buf.data, BSIZE);
+  }
+}
+
+// Can the current process sleep here to reclaim memory?
+// Not if it holds a spinlock, and not if it is reclaiming
+// or reading in already.
+static int cansleep(void) {
+  int noff;
+
+  if (swap.nslot == 0 || myproc() == 0) return 0;
+  push_off();
+  noff = mycpu()->noff;
+  pop_off();
+  return noff == 1 && !holdingsleep(&swap.iolock);
+}
+
+// Free some memory by paging out up to SWAPBATCH pages.
+// Returns the number of pages freed; 0 if none could be, or
+// if the caller can't sleep.
+int swapreclaim(void) {
+  struct proc *me = myproc(), *p;
+  uint64 pa[SWAPBATCH];
+  uint slot[SWAPBATCH];
+  int i, n, ok, nproc, total = 0, visits = 0;
+
+  if (!cansleep()) return 0;
+
+  acquiresleep(&swap.iolock);
+  // at most two full turns of the hand: the
+  // first may only clear PTE_A bits.
+  nproc = procused();
+  while (total < SWAPBATCH && visits <= 2 * nproc && swap.nfree > 0) {
+    if ((p = proclock(swap.hpid)) == 0) break;
+    if (p->pid != swap.hpid) {  // moved on, or the process went
+      swap.hpid = p->pid;
+      swap.hva = 0;
+    }
+    n = 0;
+    ok = p->pagetable != 0 && (p == me || (p->pageable && (p->state == RUNNABLE || p->state == SLEEPING)));
+    // the first turn spares processes using all they have.
+    if (ok && p != me && visits < nproc && p->wss >= p->wsrss) ok = 0;
+    if (ok) n = uvmevict(p, &swap.hva, p->sz, pa, slot, SWAPBATCH - total);
+    if (!ok || swap.hva >= p->sz) {
+      swap.hpid = p->pid + 1;
+      swap.hva = 0;
+      visits++;
+    }
+    release(&p->lock);
+
+    // the PTEs are gone, so the pages are the
+    // kernel's to write out and free.
+    for (i = 0; i < n; i++) {
+      swapio(slot[i], (char *)pa[i], 1);
+      kfree((void *)pa[i]);
+    }
+    total += n;
+  }
+  releasesleep(&swap.iolock);
+  return total;
+}
+
+// Page out until npages pages are free, if possible, for a
+// caller about to allocate them while holding a spinlock.
+void swapreserve(int npages) {
+  while (kfreemem() < npages * PGSIZE && swapreclaim() > 0)
+    ;
+}
+
+// Read back the page whose swapped-out PTE is *pte, in the
+// current process's page table, and map it with the flags it
+// had. The caller flushes the TLB.
+// Returns 0 on success, -1 if out of memory.
+int swapin(pte_t *pte) {
+  uint slot = PTE2SWAP(*pte);
+  char *mem;
+
+  // before taking iolock, since kalloc() may reclaim.
+  if ((mem = kalloc()) == 0) return -1;
+  acquiresleep(&swap.iolock);
+  swapio(slot, mem, 0);
+  releasesleep(&swap.iolock);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  swapfree(slot);
+  return 0;
+}
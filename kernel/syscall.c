@@ -88,6 +88,16 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_sysinfo(void);
+extern uint64 sys_procinfo(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_pgaccess(void);
+extern uint64 sys_setpriority(void);
 
 static uint64 (*syscalls[])(void) = {
     [SYS_fork] sys_fork,   [SYS_exit] sys_exit,     [SYS_wait] sys_wait,     [SYS_pipe] sys_pipe,
@@ -95,7 +105,9 @@ static uint64 (*syscalls[])(void) = {
     [SYS_chdir] sys_chdir, [SYS_dup] sys_dup,       [SYS_getpid] sys_getpid, [SYS_sbrk] sys_sbrk,
     [SYS_sleep] sys_sleep, [SYS_uptime] sys_uptime, [SYS_open] sys_open,     [SYS_write] sys_write,
     [SYS_mknod] sys_mknod, [SYS_unlink] sys_unlink, [SYS_link] sys_link,     [SYS_mkdir] sys_mkdir,
-    [SYS_close] sys_close,
+    [SYS_close] sys_close, [SYS_mmap] sys_mmap,     [SYS_munmap] sys_munmap, [SYS_shmget] sys_shmget,
+    [SYS_shmat] sys_shmat, [SYS_shmdt] sys_shmdt,   [SYS_sysinfo] sys_sysinfo, [SYS_procinfo] sys_procinfo,
+    [SYS_spawn] sys_spawn, [SYS_pgaccess] sys_pgaccess, [SYS_setpriority] sys_setpriority,
 };
 
 void syscall(void) {
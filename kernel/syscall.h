@@ -20,3 +20,13 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_shmget 24
+#define SYS_shmat  25
+#define SYS_shmdt  26
+#define SYS_sysinfo 27
+#define SYS_procinfo 28
+#define SYS_spawn 29
+#define SYS_pgaccess 30
+#define SYS_setpriority 31
@@ -239,7 +239,7 @@ static struct inode *create(char *path, short type, short major, short minor) {
 
 uint64 sys_open(void) {
   char path[MAXPATH];
-  int fd, omode;
+  int fd, omode, w;
   struct file *f;
   struct inode *ip;
   int n;
@@ -273,8 +273,17 @@ uint64 sys_open(void) {
     return -1;
   }
 
+  // a running program can't be written (see itextget()).
+  w = ip->type == T_FILE && (omode & (O_WRONLY | O_RDWR | O_TRUNC));
+  if (w && iwriteget(ip) < 0) {
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
     if (f) fileclose(f);
+    if (w) iwriteput(ip);
     iunlockput(ip);
     end_op();
     return -1;
@@ -294,6 +303,8 @@ uint64 sys_open(void) {
   if ((omode & O_TRUNC) && ip->type == T_FILE) {
     itrunc(ip);
   }
+  // fileclose() drops a writable file's count.
+  if (w && !f->writable) iwriteput(ip);
 
   iunlock(ip);
   end_op();
@@ -354,40 +365,59 @@ uint64 sys_chdir(void) {
   return 0;
 }
 
-uint64 sys_exec(void) {
-  char path[MAXPATH], *argv[MAXARG];
+// Copy the user argument vector at uargv into argv, in pages
+// from kalloc(); freeargv() frees them.
+// Returns 0 on success, -1 on failure.
+static int fetchargv(uint64 uargv, char **argv) {
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if (argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG * sizeof(char *));
   for (i = 0;; i++) {
-    if (i >= NELEM(argv)) {
-      goto bad;
+    if (i >= MAXARG) {
+      return -1;
     }
     if (fetchaddr(uargv + sizeof(uint64) * i, (uint64 *)&uarg) < 0) {
-      goto bad;
+      return -1;
     }
     if (uarg == 0) {
       argv[i] = 0;
-      break;
+      return 0;
     }
     argv[i] = kalloc();
-    if (argv[i] == 0) goto bad;
-    if (fetchstr(uarg, argv[i], PGSIZE) < 0) goto bad;
+    if (argv[i] == 0) return -1;
+    if (fetchstr(uarg, argv[i], PGSIZE) < 0) return -1;
   }
+}
 
-  int ret = exec(path, argv);
+static void freeargv(char **argv) {
+  for (int i = 0; i < MAXARG && argv[i] != 0; i++) kfree(argv[i]);
+}
 
-  for (i = 0; i < NELEM(argv) && argv[i] != 0; i++) kfree(argv[i]);
+uint64 sys_exec(void) {
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
 
+  if (argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0) {
+    return -1;
+  }
+  if (fetchargv(uargv, argv) == 0) ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
-bad:
-  for (i = 0; i < NELEM(argv) && argv[i] != 0; i++) kfree(argv[i]);
-  return -1;
+uint64 sys_spawn(void) {
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv, ufa;
+  int ret = -1;
+
+  if (argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 || argaddr(2, &ufa) < 0) {
+    return -1;
+  }
+  if (fetchargv(uargv, argv) == 0) ret = spawn(path, argv, ufa);
+  freeargv(argv);
+  return ret;
 }
 
 uint64 sys_pipe(void) {
@@ -415,3 +445,22 @@ uint64 sys_pipe(void) {
   }
   return 0;
 }
+
+uint64 sys_mmap(void) {
+  uint64 addr, len, off;
+  int prot, flags;
+  struct file *f = 0;
+
+  if (argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+      argaddr(5, &off) < 0)
+    return -1;
+  if ((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0) return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64 sys_munmap(void) {
+  uint64 addr, len;
+
+  if (argaddr(0, &addr) < 0 || argaddr(1, &len) < 0) return -1;
+  return munmap(addr, len);
+}
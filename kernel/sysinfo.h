@@ -0,0 +1,33 @@
+// What sysinfo() reports about the whole system.
+struct sysinfo {
+  uint64 totalmem;     // bytes of memory the kernel uses
+  uint64 freemem;      // bytes of free memory
+  uint64 nproc;        // processes in use
+  uint64 nbuf;         // buffer cache entries holding a disk block
+  uint64 bcachesize;   // buffer cache entries
+  uint64 ninode;       // inodes in the inode cache
+  uint64 freeswap;     // bytes of free swap space
+  uint64 ntext;        // pages of program text cached for sharing
+  uint64 ntextshared;  // mappings of them that share another's page
+  uint64 ncpu;         // cpus running processes
+  uint64 nswitch;      // switches to a process, since boot
+  uint64 nsteal;       // of those, to a process taken from another cpu's queue
+  uint64 kptpages;     // pages holding the kernel's page tables
+  uint64 ntlbflush;    // whole-TLB flushes, since boot
+  uint64 nasidflush;   // flushes of one address space's TLB entries
+};
+
+// What procinfo() reports about each process.
+struct procinfo {
+  int pid;
+  int state;         // enum procstate
+  uint64 sz;         // size of process memory (bytes)
+  uint64 rss;        // pages of memory resident
+  uint64 swapped;    // pages of memory swapped out
+  uint64 ptpages;    // pages holding its page tables
+  uint64 wss;        // pages used in the last working-set sample
+  int nice;          // see setpriority()
+  int prio;          // run queue level; 0 is highest
+  uint64 runtime;    // time spent running, in mtime cycles
+  char name[16];
+};
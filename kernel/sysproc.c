@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sysinfo.h"
 
 uint64 sys_exit(void) {
   int n;
@@ -24,13 +25,21 @@ uint64 sys_wait(void) {
   return wait(p);
 }
 
+// Growing the heap only moves p->sz; the pages are allocated
+// on first touch (see lazyfault() in vm.c).
 uint64 sys_sbrk(void) {
+  struct proc *p = myproc();
   int addr;
   int n;
 
   if (argint(0, &n) < 0) return -1;
-  addr = myproc()->sz;
-  if (growproc(n) < 0) return -1;
+  addr = p->sz;
+  if (n > 0) {
+    if (p->sz + n > mmapbase(p)) return -1;
+    p->sz += n;
+  } else if (growproc(n) < 0) {
+    return -1;
+  }
   return addr;
 }
 
@@ -46,7 +55,9 @@ uint64 sys_sleep(void) {
       release(&tickslock);
       return -1;
     }
+    myproc()->pageable = 1;
     sleep(&ticks, &tickslock);
+    myproc()->pageable = 0;
   }
   release(&tickslock);
   return 0;
@@ -69,3 +80,74 @@ uint64 sys_uptime(void) {
   release(&tickslock);
   return xticks;
 }
+
+uint64 sys_shmget(void) {
+  int key;
+  uint64 size;
+
+  if (argint(0, &key) < 0 || argaddr(1, &size) < 0) return -1;
+  return shmget(key, size);
+}
+
+uint64 sys_shmat(void) {
+  int id;
+
+  if (argint(0, &id) < 0) return -1;
+  return shmat(id);
+}
+
+uint64 sys_shmdt(void) {
+  uint64 addr;
+
+  if (argaddr(0, &addr) < 0) return -1;
+  return shmdt(addr);
+}
+
+// Report which of npages user pages from va have been used since
+// the last pgaccess() of them, as a bitmap at user address mask.
+uint64 sys_pgaccess(void) {
+  uint64 va, mask;
+  int npages, r;
+  uchar *bits;
+
+  if (argaddr(0, &va) < 0 || argint(1, &npages) < 0 || argaddr(2, &mask) < 0) return -1;
+  if (npages < 0 || npages > 8 * PGSIZE || va % PGSIZE != 0 || va + (uint64)npages * PGSIZE > MAXUVA) return -1;
+  if ((bits = kalloc_zeroed()) == 0) return -1;
+  uvmaccess(myproc()->pagetable, va, npages, bits);
+  r = copyout(myproc()->pagetable, mask, (char *)bits, (npages + 7) / 8);
+  kfree(bits);
+  return r;
+}
+
+uint64 sys_setpriority(void) {
+  int pid, nice;
+
+  if (argint(0, &pid) < 0 || argint(1, &nice) < 0) return -1;
+  return setpriority(pid, nice);
+}
+
+uint64 sys_sysinfo(void) {
+  struct sysinfo info;
+  uint64 addr;
+
+  if (argaddr(0, &addr) < 0) return -1;
+  info.totalmem = PHYSTOP - KERNBASE;
+  info.freemem = kfreemem();
+  info.nproc = procused();
+  info.nbuf = bcached();
+  info.bcachesize = bcachesize();
+  info.ninode = icached();
+  info.freeswap = swapfreemem();
+  itextstat(&info.ntext, &info.ntextshared);
+  schedstat(&info.ncpu, &info.nswitch, &info.nsteal);
+  vmstat(&info.kptpages, &info.ntlbflush, &info.nasidflush);
+  return copyout(myproc()->pagetable, addr, (char *)&info, sizeof(info));
+}
+
+uint64 sys_procinfo(void) {
+  uint64 addr;
+  int n;
+
+  if (argaddr(0, &addr) < 0 || argint(1, &n) < 0) return -1;
+  return procinfo(addr, n);
+}
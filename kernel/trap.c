@@ -55,6 +55,10 @@ void usertrap(void) {
     syscall();
   } else if ((which_dev = devintr()) != 0) {
     // ok
+  } else if (r_scause() == 15 && cowfault(p->pagetable, r_stval()) == 0) {
+    // store to a copy-on-write page; now it's a private copy.
+  } else if ((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) && lazyfault(p, r_stval()) == 0) {
+    // first touch of a page of the program image or heap.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -63,8 +67,15 @@ void usertrap(void) {
 
   if (p->killed) exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2) yield();
+  // give up the CPU if this is a timer interrupt and
+  // the scheduler says so. nothing here is using p's
+  // memory, so it can be paged out meanwhile.
+  if (which_dev == 2) {
+    wssample();
+    p->pageable = 1;
+    schedtick();
+    p->pageable = 0;
+  }
 
   usertrapret();
 }
@@ -83,9 +94,14 @@ void usertrapret(void) {
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
+  // p's ASID, which may be new if the generation rolled over
+  // while p was in the kernel. the kernel page table must use
+  // it too, since it shares p's user mappings.
+  uint64 asid = uvmasid(p);
+
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();          // kernel page table
+  p->trapframe->kernel_satp = MAKE_SATP(p->kpagetable, asid);  // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE;  // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();  // hartid for cpuid()
@@ -103,7 +119,7 @@ void usertrapret(void) {
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable, asid);
 
   // jump to trampoline.S at the top of memory, which
   // switches to the user page table, restores user registers,
@@ -116,6 +132,7 @@ void usertrapret(void) {
 // on whatever the current kernel stack is.
 void kerneltrap() {
   int which_dev = 0;
+  struct proc *p;
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
@@ -123,14 +140,23 @@ void kerneltrap() {
   if ((sstatus & SSTATUS_SPP) == 0) panic("kerneltrap: not from supervisor mode");
   if (intr_get() != 0) panic("kerneltrap: interrupts enabled");
 
-  if ((which_dev = devintr()) == 0) {
+  if (scause == 13 && (sstatus & SSTATUS_SUM) && (p = myproc()) != 0) {
+    // a load by copyin_new() from a page of user memory
+    // that isn't there yet.
+    w_sstatus(sstatus & ~SSTATUS_SUM);
+    if (p->ucopyerr == 0 && lazyfault(p, r_stval()) != 0) p->ucopyerr = 1;
+    // if the page can't be had, skip the load (2 bytes if
+    // compressed, else 4); the copy will fail.
+    if (p->ucopyerr) sepc += (*(ushort *)sepc & 3) == 3 ? 4 : 2;
+  } else if ((which_dev = devintr()) == 0) {
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING) yield();
+  // give up the CPU if this is a timer interrupt
+  // and the scheduler says so.
+  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING) schedtick();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -3,8 +3,14 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "sysinfo.h"
+
+// kalloc_pages() order of a megapage.
+#define MEGAORDER 9
 
 /*
  * the kernel's page table.
@@ -15,12 +21,31 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[];  // trampoline.S
 
+// Address-space identifiers. A user page table gets an ASID the
+// first time it is switched to, so TLB entries of different page
+// tables can coexist and returning to user space doesn't have to
+// flush the TLB. ASIDs are handed out in increasing order. When
+// they run out, a new generation starts: every page table needs
+// a fresh ASID, and every cpu flushes its whole TLB before it
+// uses one. ASID 0 is kernel_pagetable's. A process's kernel
+// page table uses the ASID of its user page table: the two
+// agree on every address that both of them map.
+struct {
+  struct spinlock lock;
+  uint64 gen;   // current generation, in the bits above ASIDMASK
+  uint64 next;  // next unused ASID in this generation
+  uint64 max;   // largest ASID the hardware implements; 0 if none
+} asids;
+
 /*
  * create a direct-map page table for the kernel.
  */
 void kvminit() {
-  kernel_pagetable = (pagetable_t)kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  initlock(&asids.lock, "asid");
+  asids.gen = ASIDMASK + 1;  // no process has an ASID yet
+  asids.next = 1;
+
+  kernel_pagetable = (pagetable_t)kalloc_zeroed();
 
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -43,13 +68,145 @@ void kvminit() {
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+
+#ifdef DEBUG
+  printf("kvminit: %d page-table pages\n", pgtblpages(kernel_pagetable));
+#endif
 }
 
 // Switch h/w page table register to the kernel's page table,
 // and enable paging.
 void kvminithart() {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  if (cpuid() == 0) {
+    // find out how many ASID bits are implemented: write
+    // all ones and see which ones stick.
+    w_satp(MAKE_SATP(kernel_pagetable, ASIDMASK));
+    asids.max = (r_satp() >> SATP_ASID_SHIFT) & ASIDMASK;
+  }
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
+  tlbflush();
+}
+
+// Flush this cpu's TLB, counting the flush for sysinfo().
+void tlbflush(void) {
+  push_off();
   sfence_vma();
+  mycpu()->ntlbflush++;
+  pop_off();
+}
+
+// Flush this cpu's TLB entries for ASID asid.
+static void tlbflushasid(uint64 asid) {
+  push_off();
+  sfence_vma_asid(asid);
+  mycpu()->ntlbflushasid++;
+  pop_off();
+}
+
+// Page-table and TLB counters for sysinfo(): the pages of
+// kernel_pagetable's page tables, which kernel stacks grow,
+// and the TLB flushes of all cpus. QEMU's virt machine gives
+// supervisor mode no TLB miss counter to report.
+void vmstat(uint64 *kptpages, uint64 *nflush, uint64 *nflushasid) {
+  struct cpu *c;
+
+  // unlocked: page-table pages are never freed from
+  // kernel_pagetable, so the walk sees a valid count.
+  *kptpages = pgtblpages(kernel_pagetable);
+  *nflush = *nflushasid = 0;
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    *nflush += c->ntlbflush;
+    *nflushasid += c->ntlbflushasid;
+  }
+}
+
+// Create the kernel page table for a process whose user page
+// table is pagetable. It is kernel_pagetable, except that it
+// shares the user page table's level-1 page table for the first
+// gigabyte of addresses. That maps the process's memory, below
+// MAXUVA, and the devices above it (see uvmcreate()), so the
+// kernel can read user memory with plain loads (see
+// vmcopyin.c), and every change to the user mappings shows up
+// here without having to copy it.
+// Returns 0 if out of memory.
+pagetable_t kvmcreate(pagetable_t pagetable) {
+  pagetable_t kpagetable;
+
+  if ((kpagetable = (pagetable_t)kalloc()) == 0) return 0;
+  memmove(kpagetable, kernel_pagetable, PGSIZE);
+  kpagetable[0] = pagetable[0];
+  return kpagetable;
+}
+
+// Free a page table made by kvmcreate(). The page-table pages
+// below its root belong to kernel_pagetable or the user page
+// table.
+void kvmfree(pagetable_t kpagetable) { kfree((void *)kpagetable); }
+
+// Switch this cpu to p's kernel page table,
+// or to kernel_pagetable if p is 0.
+// Called by scheduler() and exec(), with interrupts off.
+void kvmswitch(struct proc *p) {
+  if (p == 0)
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
+  else
+    w_satp(MAKE_SATP(p->kpagetable, uvmasid(p)));
+}
+
+// Return the ASID for p's page tables, giving them one from the
+// current generation if needed, and flush whatever this cpu's
+// TLB may hold that is stale for them. Called with interrupts
+// off by kvmswitch() and usertrapret().
+uint64 uvmasid(struct proc *p) {
+  struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 gen;
+
+  if (asids.max == 0) {
+    // no ASIDs: flush everything, every time.
+    tlbflush();
+    return 0;
+  }
+
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if ((p->asid & ~ASIDMASK) != gen) {
+    acquire(&asids.lock);
+    if (asids.next > asids.max) {
+      // rollover.
+      asids.gen += ASIDMASK + 1;
+      asids.next = 1;
+    }
+    gen = asids.gen;
+    p->asid = gen | asids.next++;
+    release(&asids.lock);
+    p->asidcpu = id;  // no cpu has used this ASID since its last flush
+  }
+
+  if (c->asidgen != gen) {
+    // the new generation reuses ASIDs this cpu may have cached.
+    tlbflush();
+    c->asidgen = gen;
+  } else if (p->asidcpu != id) {
+    // p may have changed its mappings while on another cpu.
+    tlbflushasid(p->asid & ASIDMASK);
+  }
+  p->asidcpu = id;
+  return p->asid & ASIDMASK;
+}
+
+// Flush this cpu's TLB entries for user page table pagetable,
+// and so for the kernel page table that shares its mappings,
+// after changing them. Only the current process's page
+// table can have entries in the TLB; other cpus flush when the
+// process next runs there (see uvmasid()).
+static void uvmflush(pagetable_t pagetable) {
+  struct proc *p = myproc();
+
+  if (p == 0 || p->pagetable != pagetable) return;
+  if (asids.max == 0)
+    tlbflush();
+  else
+    tlbflushasid(p->asid & ASIDMASK);
 }
 
 // Return the address of the PTE in page table pagetable
@@ -64,20 +221,85 @@ void kvminithart() {
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE at level 1 maps a whole 2-megabyte megapage;
+// walk() returns it if it finds one on the way down.
 pte_t *walk(pagetable_t pagetable, uint64 va, int alloc) {
+  int level = 0;
+
+  return walklevel(pagetable, va, &level, alloc);
+}
+
+// Like walk(), but stop at the PTE at level *level (0 for
+// 4096-byte pages, 1 for megapages), or at a leaf above it,
+// and set *level to the level of the PTE returned.
+pte_t *walklevel(pagetable_t pagetable, uint64 va, int *level, int alloc) {
   if (va >= MAXVA) panic("walk");
 
-  for (int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for (int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if (*pte & PTE_V) {
+      if (PTE_LEAF(*pte)) {
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if (!alloc || (pagetable = (pde_t *)kalloc()) == 0) return 0;
-      memset(pagetable, 0, PGSIZE);
+      if (!alloc || (pagetable = (pde_t *)kalloc_zeroed()) == 0) return 0;
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
+}
+
+// The physical address of the 4096-byte page holding va,
+// given the leaf PTE that maps va at level.
+static uint64 ptepa(pte_t pte, uint64 va, int level) {
+  return PTE2PA(pte) + (PGROUNDDOWN(va) & ((1L << PXSHIFT(level)) - 1));
+}
+
+// Return the level-1 leaf PTE if va lies in a megapage,
+// 0 otherwise.
+static pte_t *megapte(pagetable_t pagetable, uint64 va) {
+  int level = 1;
+  pte_t *pte;
+
+  pte = walklevel(pagetable, va, &level, 0);
+  if (pte == 0 || level != 1 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte)) return 0;
+  return pte;
+}
+
+// Replace the megapage leaf *pte by a new level-0 page table
+// that maps the same 512 pages with the same flags.
+// Returns 0 on success, -1 if out of memory.
+static int megasplit(pte_t *pte) {
+  pagetable_t pagetable;
+  uint64 pa = PTE2PA(*pte);
+  uint flags = PTE_FLAGS(*pte);
+
+  if ((pagetable = (pagetable_t)kalloc()) == 0) return -1;
+  for (int i = 0; i < 512; i++) pagetable[i] = PA2PTE(pa + i * PGSIZE) | flags;
+  // the translations are unchanged, so no need to flush.
+  *pte = PA2PTE(pagetable) | PTE_V;
+  return 0;
+}
+
+// Like walk(pagetable, va, 0), but if va is a page of the
+// current process's heap that sbrk() has not allocated yet,
+// allocate it first, so that copyin() and copyout() see the
+// page just as a user load or store would.
+// Sets *level like walklevel().
+static pte_t *uwalk(pagetable_t pagetable, uint64 va, int *level) {
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  *level = 0;
+  pte = walklevel(pagetable, va, level, 0);
+  if ((pte == 0 || (*pte & PTE_V) == 0) && p != 0 && pagetable == p->pagetable && lazyfault(p, va) == 0) {
+    *level = 0;
+    pte = walklevel(pagetable, va, level, 0);
+  }
+  return pte;
 }
 
 // Look up a virtual address, return the physical address,
@@ -85,16 +307,15 @@ pte_t *walk(pagetable_t pagetable, uint64 va, int alloc) {
 // Can only be used to look up user pages.
 uint64 walkaddr(pagetable_t pagetable, uint64 va) {
   pte_t *pte;
-  uint64 pa;
+  int level;
 
   if (va >= MAXVA) return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = uwalk(pagetable, va, &level);
   if (pte == 0) return 0;
   if ((*pte & PTE_V) == 0) return 0;
   if ((*pte & PTE_U) == 0) return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  return ptepa(*pte, va, level);
 }
 
 // add a mapping to the kernel page table.
@@ -104,71 +325,246 @@ void kvmmap(uint64 va, uint64 pa, uint64 sz, int perm) {
   if (mappages(kernel_pagetable, va, sz, pa, perm) != 0) panic("kvmmap");
 }
 
+// map a process's kernel stack at va, after boot.
+// every process's kernel page table sees it too, since
+// they share the level-1 page table for the kernel
+// stacks (see kvmcreate()). caller serializes calls.
+// returns 0, or -1 if out of memory.
+int kvmmapstack(uint64 va, uint64 pa) { return mappages(kernel_pagetable, va, PGSIZE, pa, PTE_R | PTE_W); }
+
+// unmap and free the kernel stack at va. caller
+// serializes calls, and sees to the TLBs.
+void kvmunmapstack(uint64 va) { uvmunmap(kernel_pagetable, va, 1, 1); }
+
 // translate a kernel virtual address to
 // a physical address. only needed for
 // addresses on the stack.
-// assumes va is page aligned.
 uint64 kvmpa(uint64 va) {
-  uint64 off = va % PGSIZE;
   pte_t *pte;
-  uint64 pa;
+  int level = 0;
 
-  pte = walk(kernel_pagetable, va, 0);
+  pte = walklevel(kernel_pagetable, va, &level, 0);
   if (pte == 0) panic("kvmpa");
   if ((*pte & PTE_V) == 0) panic("kvmpa");
-  pa = PTE2PA(*pte);
-  return pa + off;
+  return PTE2PA(*pte) + va % (1L << PXSHIFT(level));
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where va and pa are both megapage-aligned and
+// the rest of the range covers a whole megapage, map it with a
+// single level-1 PTE. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm) {
-  uint64 a, last;
+  uint64 a, last, sz;
   pte_t *pte;
+  int level;
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for (;;) {
-    if ((pte = walk(pagetable, a, 1)) == 0) return -1;
+    sz = PGSIZE;
+    pte = 0;
+    if (a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && last - a >= MEGAPGSIZE - PGSIZE) {
+      level = 1;
+      if ((pte = walklevel(pagetable, a, &level, 1)) == 0) return -1;
+      if ((*pte & PTE_V) && PTE_LEAF(*pte)) panic("remap");
+      if (*pte & PTE_V)
+        pte = 0;  // already has a level-0 page table; use it
+      else
+        sz = MEGAPGSIZE;
+    }
+    if (pte == 0 && (pte = walk(pagetable, a, 1)) == 0) return -1;
     if (*pte & PTE_V) panic("remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if (a == last) break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    if (last - a < sz) break;
+    a += sz;
+    pa += sz;
   }
   return 0;
 }
 
+// Count the page-table pages in pagetable,
+// including pagetable itself.
+int pgtblpages(pagetable_t pagetable) {
+  int n = 1;
+
+  for (int i = 0; i < 512; i++) {
+    pte_t pte = pagetable[i];
+    if ((pte & PTE_V) && !PTE_LEAF(pte)) n += pgtblpages((pagetable_t)PTE2PA(pte));
+  }
+  return n;
+}
+
+// Add up the user pages of page table pagetable, which maps
+// addresses from va at level, into *pi.
+static void uvmcount(pagetable_t pagetable, int level, uint64 va, struct procinfo *pi) {
+  uint64 a;
+  pte_t pte;
+
+  pi->ptpages++;
+  for (int i = 0; i < 512; i++) {
+    pte = pagetable[i];
+    a = va + ((uint64)i << PXSHIFT(level));
+    // kernel_pagetable's devices (see uvmcreate()).
+    if (a >= MAXUVA && a < (1L << PXSHIFT(2))) continue;
+    if ((pte & PTE_V) && !PTE_LEAF(pte))
+      uvmcount((pagetable_t)PTE2PA(pte), level - 1, a, pi);
+    else if ((pte & PTE_V) && (pte & PTE_U))
+      pi->rss += 1L << (9 * level);
+    else if (PTE_SWAPPED(pte))
+      pi->swapped++;
+  }
+}
+
+// Fill in the memory use in *pi of the process whose user page
+// table is pagetable: its resident and swapped-out pages, and
+// its page-table pages, counting those of its kernel page table
+// that aren't kernel_pagetable's (see kvmcreate()).
+void uvmstat(pagetable_t pagetable, struct procinfo *pi) {
+  pi->rss = pi->swapped = pi->ptpages = 0;
+  uvmcount(pagetable, 2, 0, pi);
+  pi->ptpages++;
+}
+
+// Count the user pages of page table pagetable, which maps
+// addresses from va at level, that are resident (*rss) and that
+// have been used since the last sample (*wss). PTE_A becomes
+// PTE_REF, for pgaccess().
+static void uvmsample1(pagetable_t pagetable, int level, uint64 va, uint64 *rss, uint64 *wss) {
+  uint64 a;
+  pte_t *pte;
+
+  for (int i = 0; i < 512; i++) {
+    pte = &pagetable[i];
+    a = va + ((uint64)i << PXSHIFT(level));
+    // kernel_pagetable's devices (see uvmcreate()).
+    if (a >= MAXUVA && a < (1L << PXSHIFT(2))) continue;
+    if ((*pte & PTE_V) && !PTE_LEAF(*pte)) {
+      uvmsample1((pagetable_t)PTE2PA(*pte), level - 1, a, rss, wss);
+    } else if ((*pte & (PTE_V | PTE_U)) == (PTE_V | PTE_U)) {
+      *rss += 1L << (9 * level);
+      if (*pte & PTE_A) {
+        *wss += 1L << (9 * level);
+        *pte = (*pte & ~PTE_A) | PTE_REF;
+      }
+    }
+  }
+}
+
+// Sample p's working set: set p->wss to the number of pages it
+// has used since the last sample, and p->wsrss to the number it
+// has resident. Called with p->lock held.
+void uvmsample(struct proc *p) {
+  p->wss = p->wsrss = 0;
+  uvmsample1(p->pagetable, 2, 0, &p->wsrss, &p->wss);
+  // the TLB may hold PTEs with PTE_A set, and the
+  // hardware would not set it again.
+  if (p == myproc())
+    uvmflush(p->pagetable);
+  else
+    p->asidcpu = -1;  // flush wherever p runs next (see uvmasid())
+}
+
+// Set bit i of bits for each page i of the npages user pages
+// from va that has been used since the last call for it, and
+// clear PTE_A and PTE_REF so the next call sees only later use.
+// All the pages of a megapage share its bits.
+void uvmaccess(pagetable_t pagetable, uint64 va, uint64 npages, uchar *bits) {
+  uint64 a, i, n, j;
+  pte_t *pte;
+  int level;
+
+  for (i = 0; i < npages; i += n) {
+    a = va + i * PGSIZE;
+    level = 0;
+    pte = walklevel(pagetable, a, &level, 0);
+    // to the next megapage boundary, or just this page.
+    n = pte == 0 || level == 1 ? (MEGAPGROUNDDOWN(a) + MEGAPGSIZE - a) / PGSIZE : 1;
+    if (n > npages - i) n = npages - i;
+    if (pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U)) continue;
+    if (*pte & (PTE_A | PTE_REF)) {
+      for (j = i; j < i + n; j++) bits[j / 8] |= 1 << (j % 8);
+      *pte &= ~(PTE_A | PTE_REF);
+    }
+  }
+  uvmflush(pagetable);
+}
+
+// Count the user megapages mapped in page table pagetable.
+int uvmmegapages(pagetable_t pagetable) {
+  pagetable_t l1;
+  int n = 0;
+
+  for (int i = 0; i < 512; i++) {
+    if ((pagetable[i] & PTE_V) == 0 || PTE_LEAF(pagetable[i])) continue;
+    l1 = (pagetable_t)PTE2PA(pagetable[i]);
+    for (int j = 0; j < 512; j++)
+      if ((l1[j] & (PTE_V | PTE_U)) == (PTE_V | PTE_U) && PTE_LEAF(l1[j])) n++;
+  }
+  return n;
+}
+
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// Optionally free the physical memory, and the swap
+// slots of pages that are swapped out.
+// A megapage only partly in the range is split first.
 void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
-  uint64 a;
+  uint64 a, end;
   pte_t *pte;
+  int level;
 
   if ((va % PGSIZE) != 0) panic("uvmunmap: not aligned");
 
-  for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
-    if ((pte = walk(pagetable, a, 0)) == 0) panic("uvmunmap: walk");
-    if ((*pte & PTE_V) == 0) panic("uvmunmap: not mapped");
+  end = va + npages * PGSIZE;
+  for (a = va; a < end; a += PGSIZE) {
+    level = 0;
+    // heap pages that were never touched aren't mapped.
+    if ((pte = walklevel(pagetable, a, &level, 0)) == 0) continue;
+    if ((*pte & PTE_V) == 0) {
+      if (PTE_SWAPPED(*pte) && do_free) swapfree(PTE2SWAP(*pte));
+      *pte = 0;
+      continue;
+    }
     if (PTE_FLAGS(*pte) == PTE_V) panic("uvmunmap: not a leaf");
+    if (level == 1 && a % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE) {
+      if (do_free) kfree_pages((void *)PTE2PA(*pte), MEGAORDER);
+      *pte = 0;
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    if (level == 1) {
+      if (megasplit(pte) != 0) panic("uvmunmap: split");
+      pte = walk(pagetable, a, 0);
+    }
     if (do_free) {
       uint64 pa = PTE2PA(*pte);
       kfree((void *)pa);
     }
     *pte = 0;
   }
+  uvmflush(pagetable);
 }
 
 // create an empty user page table.
+// its level-1 page table for the first gigabyte holds the
+// kernel's PTEs for the devices at and above MAXUVA, for the
+// process's kernel page table (see kvmcreate()). They lack
+// PTE_U, so user code can't use them.
 // returns 0 if out of memory.
 pagetable_t uvmcreate() {
-  pagetable_t pagetable;
-  pagetable = (pagetable_t)kalloc();
+  pagetable_t pagetable, l1, kl1;
+
+  pagetable = (pagetable_t)kalloc_zeroed();
   if (pagetable == 0) return 0;
-  memset(pagetable, 0, PGSIZE);
+  if ((l1 = (pagetable_t)kalloc_zeroed()) == 0) {
+    kfree(pagetable);
+    return 0;
+  }
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for (int i = PX(1, MAXUVA); i < 512; i++) l1[i] = kl1[i];
+  pagetable[0] = PA2PTE(l1) | PTE_V;
   return pagetable;
 }
 
@@ -179,8 +575,7 @@ void uvminit(pagetable_t pagetable, uchar *src, uint sz) {
   char *mem;
 
   if (sz >= PGSIZE) panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W | PTE_R | PTE_X | PTE_U);
   memmove(mem, src, sz);
 }
@@ -195,12 +590,11 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
 
   oldsz = PGROUNDUP(oldsz);
   for (a = oldsz; a < newsz; a += PGSIZE) {
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if (mem == 0) {
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) != 0) {
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -215,8 +609,16 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
 uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
+  pte_t *pte;
+
   if (newsz >= oldsz) return oldsz;
 
+  // split a megapage that newsz cuts in two here, where
+  // running out of memory can still be reported.
+  if ((pte = megapte(pagetable, PGROUNDUP(newsz))) != 0 && PGROUNDUP(newsz) % MEGAPGSIZE != 0 &&
+      megasplit(pte) != 0)
+    return oldsz;
+
   if (PGROUNDUP(newsz) < PGROUNDUP(oldsz)) {
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
@@ -231,7 +633,7 @@ void freewalk(pagetable_t pagetable) {
   // there are 2^9 = 512 PTEs in a page table.
   for (int i = 0; i < 512; i++) {
     pte_t pte = pagetable[i];
-    if ((pte & PTE_V) && (pte & (PTE_R | PTE_W | PTE_X)) == 0) {
+    if ((pte & PTE_V) && !PTE_LEAF(pte)) {
       // this PTE points to a lower-level page table.
       uint64 child = PTE2PA(pte);
       freewalk((pagetable_t)child);
@@ -246,7 +648,11 @@ void freewalk(pagetable_t pagetable) {
 // Free user memory pages,
 // then free page-table pages.
 void uvmfree(pagetable_t pagetable, uint64 sz) {
+  pagetable_t l1 = (pagetable_t)PTE2PA(pagetable[0]);
+
   if (sz > 0) uvmunmap(pagetable, 0, PGROUNDUP(sz) / PGSIZE, 1);
+  // the device PTEs belong to kernel_pagetable.
+  for (int i = PX(1, MAXUVA); i < 512; i++) l1[i] = 0;
   freewalk(pagetable);
 }
 
@@ -256,29 +662,221 @@ void uvmfree(pagetable_t pagetable, uint64 sz) {
 // physical memory.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
-int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
+int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) { return uvmcopyrange(old, new, 0, sz, 0); }
+
+// Like uvmcopy(), but for the pages in [va, end). If shared,
+// parent and child share the pages, writes and all, rather
+// than each getting a copy when it writes.
+int uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 end, int shared) {
+  pte_t *pte, *npte;
+  uint64 pa, i, n, j;
+  uint flags;
+  int level;
+
+  for (i = va; i < end; i += PGSIZE) {
+    level = 0;
+    // the child allocates untouched heap pages itself.
+    if ((pte = walklevel(old, i, &level, 0)) == 0) continue;
+    if (PTE_SWAPPED(*pte)) {
+      // a swapped-out page: share the slot instead.
+      if ((npte = walk(new, i, 1)) == 0) goto err;
+      swapdup(PTE2SWAP(*pte));
+      *npte = *pte;
+      continue;
+    }
+    if ((*pte & PTE_V) == 0) continue;
+    pa = PTE2PA(*pte);
+    // share the page; unless shared, whichever side writes
+    // to it first takes a store fault and gets its own copy.
+    if (!shared && (*pte & (PTE_W | PTE_COW))) *pte = (*pte & ~PTE_W) | PTE_COW;
+    flags = PTE_FLAGS(*pte);
+    // a megapage stays a megapage in the child.
+    n = level == 1 ? MEGAPGSIZE : PGSIZE;
+    if (mappages(new, i, n, pa, flags) != 0) goto err;
+    for (j = 0; j < n; j += PGSIZE) kdup((void *)(pa + j));
+    i += n - PGSIZE;
+  }
+  uvmflush(old);  // old's PTEs lost PTE_W
+  return 0;
+
+err:
+  uvmflush(old);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
+  return -1;
+}
+
+// Should lazyfault() map the whole 2-megabyte stretch around
+// va with a zeroed megapage? Only if none of the stretch is
+// mapped yet, all of it lies below p->sz, none of it has to
+// be read from the program file, and a quarter of memory
+// would still be free for 4096-byte pages.
+static int megaok(struct proc *p, uint64 va) {
+  uint64 a = MEGAPGROUNDDOWN(va);
+  struct seg *sg;
+  pte_t *pte;
+  int level = 1;
+
+  if (a + MEGAPGSIZE > p->sz || a + MEGAPGSIZE > MAXUVA) return 0;
+  if ((pte = walklevel(p->pagetable, a, &level, 0)) != 0 && (*pte & PTE_V)) return 0;
+  for (sg = p->seg; sg < &p->seg[p->nseg]; sg++)
+    if (sg->va < a + MEGAPGSIZE && a < sg->va + sg->filesz) return 0;
+  return kfreemem() >= MEGAPGSIZE + (PHYSTOP - KERNBASE) / 4;
+}
+
+// Allocate and map the page at va, which p has not touched
+// until now, or read it back in if it was swapped out: below
+// p->sz, either part of the program image,
+// read in from the file by loadpage(), or a zeroed page of bss
+// or of heap grown by sbrk(); above, a page of a region mapped
+// by mmap() or shmat(), which vmapage() provides.
+// Returns 0 on success, -1 if va is not such a page or the
+// page can't be allocated or read.
+int lazyfault(struct proc *p, uint64 va) {
+  int perm = PTE_W | PTE_X | PTE_R | PTE_U;
+  struct vma *v = 0;
+  pte_t *pte;
+  char *mem;
+
+  if (va >= MAXVA) return -1;
+  if (va >= p->sz && ((v = vmafind(p, va)) == 0 || (perm = vmaperm(v)) == 0)) return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(p->pagetable, va, 0);
+  if (pte != 0 && PTE_SWAPPED(*pte)) {
+    if (swapin(pte) != 0) return -1;
+    uvmflush(p->pagetable);
+    return 0;
+  }
+  // already mapped: a protection fault, or the stack guard page.
+  if (pte != 0 && (*pte & PTE_V)) return -1;
+  if (v == 0 && megaok(p, va) && (mem = kalloc_pages(MEGAORDER)) != 0) {
+    memset(mem, 0, MEGAPGSIZE);
+    if (mappages(p->pagetable, MEGAPGROUNDDOWN(va), MEGAPGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) == 0) {
+      uvmflush(p->pagetable);
+      return 0;
+    }
+    kfree_pages(mem, MEGAORDER);
+  }
+  if (v != 0)
+    mem = vmapage(v, va);
+  else
+    mem = loadpage(p, va, &perm);
+  if (mem == 0) return -1;
+  if (mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0) {
+    kfree(mem);
+    return -1;
+  }
+  // the cpu may have cached the invalid PTE.
+  uvmflush(p->pagetable);
+  return 0;
+}
+
+// Resolve a write to a copy-on-write page at va: copy the
+// page, unless this page table holds the only reference to
+// it, and map it writable.
+// Returns 0 on success, -1 if va is not a copy-on-write page
+// or there is no memory for the copy.
+int cowfault(pagetable_t pagetable, uint64 va) {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa;
   uint flags;
   char *mem;
+  int i;
 
-  for (i = 0; i < sz; i += PGSIZE) {
-    if ((pte = walk(old, i, 0)) == 0) panic("uvmcopy: pte should exist");
-    if ((*pte & PTE_V) == 0) panic("uvmcopy: page not present");
+  if (va >= MAXVA) return -1;
+  if ((pte = megapte(pagetable, va)) != 0) {
+    if ((*pte & (PTE_U | PTE_COW)) != (PTE_U | PTE_COW)) return -1;
     pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if ((mem = kalloc()) == 0) goto err;
-    memmove(mem, (char *)pa, PGSIZE);
-    if (mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-      kfree(mem);
-      goto err;
+    for (i = 0; i < 512; i++)
+      if (krefcnt((void *)(pa + i * PGSIZE)) != 1) break;
+    if (i == 512) {
+      // no longer shared: keep the megapage.
+      *pte = (*pte & ~PTE_COW) | PTE_W;
+      uvmflush(pagetable);
+      return 0;
+    }
+    // copy just the page written to.
+    if (megasplit(pte) != 0) return -1;
+  }
+  pte = walk(pagetable, va, 0);
+  if (pte == 0 || (*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW)) return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if (krefcnt((void *)pa) == 1) {
+    // the other sharers have copied or exited.
+    *pte = PA2PTE(pa) | flags;
+  } else {
+    // hold on to the page, or kalloc() might page it out
+    // if the other sharers let go of it meanwhile.
+    kdup((void *)pa);
+    if ((mem = kalloc()) == 0) {
+      kfree((void *)pa);
+      return -1;
     }
+    memmove(mem, (char *)pa, PGSIZE);
+    *pte = PA2PTE(mem) | flags;
+    kfree((void *)pa);
+    kfree((void *)pa);
   }
+  uvmflush(pagetable);
   return 0;
+}
 
-err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
-  return -1;
+// The clock hand of swapreclaim(), in p's memory: look at the
+// pages from *va up to end, stopping after n victims, and set
+// *va to where the hand should go on from. A page used since
+// the hand last came by (PTE_A) loses the bit and is passed
+// over; one that wasn't is a victim if no other page table has
+// it. Its PTE is replaced by one that records a new swap slot,
+// and the page and the slot go in pa[] and slot[], for the
+// caller to write out and free. An unused megapage is split
+// first, except in the current process, which may be about to
+// split or free it itself. Called with p->lock held.
+// Returns the number of victims.
+int uvmevict(struct proc *p, uint64 *va, uint64 end, uint64 *pa, uint *slot, int n) {
+  uint64 a, next;
+  pte_t *pte;
+  int i, s, level, nv = 0, changed = 0;
+
+  for (a = PGROUNDDOWN(*va); a < end && nv < n; a += PGSIZE) {
+    level = 0;
+    next = MEGAPGROUNDDOWN(a) + MEGAPGSIZE - PGSIZE;  // the last page before the next megapage
+    if ((pte = walklevel(p->pagetable, a, &level, 0)) == 0) {
+      a = next;  // no level-0 page table
+      continue;
+    }
+    if ((*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U)) continue;
+    if (*pte & PTE_A) {
+      *pte = (*pte & ~PTE_A) | PTE_REF;  // for pgaccess()
+      changed = 1;
+      if (level == 1) a = next;
+      continue;
+    }
+    if (level == 1) {
+      for (i = 0; i < 512; i++)
+        if (krefcnt((void *)(PTE2PA(*pte) + i * PGSIZE)) != 1) break;
+      if (i == 512 && p != myproc() && megasplit(pte) == 0)
+        a -= PGSIZE;  // again, in the new level-0 page table
+      else
+        a = next;
+      continue;
+    }
+    if (krefcnt((void *)PTE2PA(*pte)) != 1) continue;
+    if ((s = swapalloc()) < 0) break;
+    pa[nv] = PTE2PA(*pte);
+    slot[nv++] = s;
+    *pte = SWAP2PTE(s) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    changed = 1;
+  }
+  *va = a;
+
+  if (changed) {
+    if (p == myproc())
+      uvmflush(p->pagetable);
+    else
+      p->asidcpu = -1;  // flush wherever p runs next (see uvmasid())
+  }
+  return nv;
 }
 
 // mark a PTE invalid for user access.
@@ -291,83 +889,104 @@ void uvmclear(pagetable_t pagetable, uint64 va) {
   *pte &= ~PTE_U;
 }
 
+// Find the run of user memory that starts at va and is mapped
+// to consecutive physical pages, so that copyin() and friends
+// walk the page table once per run rather than once per page:
+// the rest of a megapage, or following PTEs in the same level-0
+// page table. If write, copy-on-write pages are copied first, as
+// a user store would. Returns the physical address of va and
+// sets *n to the length of the run, at most len, or returns 0
+// if va isn't mapped for the user.
+static uint64 urun(pagetable_t pagetable, uint64 va, uint64 len, int write, uint64 *n) {
+  uint64 va0 = PGROUNDDOWN(va), pa, end, need;
+  pte_t *pte;
+  int level;
+
+  if (va0 >= MAXVA) return 0;
+  pte = uwalk(pagetable, va0, &level);
+  if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0) return 0;
+  if (write && (*pte & PTE_W) == 0) {
+    if (cowfault(pagetable, va0) != 0) return 0;
+    level = 0;
+    pte = walklevel(pagetable, va0, &level, 0);  // cowfault() may have split a megapage
+  }
+
+  pa = ptepa(*pte, va0, level) + (va - va0);
+  // like a user store, a write marks the pages dirty,
+  // for munmap() of a MAP_SHARED mapping.
+  if (write) *pte |= PTE_D;
+  need = PTE_V | PTE_U | (write ? PTE_W : 0);
+  if (level == 1) {
+    end = MEGAPGROUNDDOWN(va) + MEGAPGSIZE;
+  } else {
+    end = va0 + PGSIZE;
+    for (; end - va < len && end % MEGAPGSIZE != 0; end += PGSIZE, pte++) {
+      if ((pte[1] & need) != need || PTE2PA(pte[1]) != PTE2PA(pte[0]) + PGSIZE) break;
+      if (write) pte[1] |= PTE_D;
+    }
+  }
+  *n = end - va < len ? end - va : len;
+  return pa;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Copy-on-write pages are copied first, as a user store would.
 // Return 0 on success, -1 on error.
 int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
-  uint64 n, va0, pa0;
+  uint64 n, pa;
 
   while (len > 0) {
-    va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0) return -1;
-    n = PGSIZE - (dstva - va0);
-    if (n > len) n = len;
-    memmove((void *)(pa0 + (dstva - va0)), src, n);
+    if ((pa = urun(pagetable, dstva, len, 1, &n)) == 0) return -1;
+    memmove((void *)pa, src, n);
 
     len -= n;
     src += n;
-    dstva = va0 + PGSIZE;
+    dstva += n;
   }
   return 0;
 }
 
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
+// The current process's memory is mapped in the kernel page table
+// too, so for its page table this is copyin_new().
 // Return 0 on success, -1 on error.
 int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
-  uint64 n, va0, pa0;
+  struct proc *p = myproc();
+  uint64 n, pa;
+
+  if (p != 0 && pagetable == p->pagetable) return copyin_new(pagetable, dst, srcva, len);
 
   while (len > 0) {
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0) return -1;
-    n = PGSIZE - (srcva - va0);
-    if (n > len) n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    if ((pa = urun(pagetable, srcva, len, 0, &n)) == 0) return -1;
+    memmove(dst, (void *)pa, n);
 
     len -= n;
     dst += n;
-    srcva = va0 + PGSIZE;
+    srcva += n;
   }
   return 0;
 }
 
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
-// until a '\0', or max.
+// until a '\0', or max. Like copyin(), uses copyinstr_new()
+// for the current process's page table.
 // Return 0 on success, -1 on error.
 int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
-  uint64 n, va0, pa0;
-  int got_null = 0;
-
-  while (got_null == 0 && max > 0) {
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0) return -1;
-    n = PGSIZE - (srcva - va0);
-    if (n > max) n = max;
-
-    char *p = (char *)(pa0 + (srcva - va0));
-    while (n > 0) {
-      if (*p == '\0') {
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
-    }
+  struct proc *p = myproc();
+  uint64 n, pa;
 
-    srcva = va0 + PGSIZE;
-  }
-  if (got_null) {
-    return 0;
-  } else {
-    return -1;
+  if (p != 0 && pagetable == p->pagetable) return copyinstr_new(pagetable, dst, srcva, max);
+
+  while (max > 0) {
+    if ((pa = urun(pagetable, srcva, max, 0, &n)) == 0) return -1;
+    if (strnmove(dst, (char *)pa, n) < n) return 0;
+
+    max -= n;
+    dst += n;
+    srcva += n;
   }
+  return -1;
 }
@@ -0,0 +1,68 @@
+#include "param.h"
+#include "types.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+// Copying in from the current process's memory with plain
+// loads. The process runs in the kernel on p->kpagetable, which
+// maps its memory at the same addresses as p->pagetable (see
+// kvmcreate()), so there is no page table to walk in software.
+//
+// The loads run with sstatus.SUM set, since the pages have
+// PTE_U. A page the process hasn't touched yet takes a page
+// fault, which kerneltrap() resolves with lazyfault(). If it
+// can't, it sets p->ucopyerr and skips the load, and the copy
+// fails.
+
+static void ucopybegin(struct proc *p) {
+  p->ucopyerr = 0;
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+}
+
+static int ucopyend(struct proc *p) {
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  return p->ucopyerr ? -1 : 0;
+}
+
+// The end of the stretch of p's memory that holds va: p->sz,
+// or the end of an mmap()ed region. 0 if va isn't p's memory.
+static uint64 uend(struct proc *p, uint64 va) {
+  struct vma *v;
+
+  if (va < p->sz) return p->sz;
+  if ((v = vmafind(p, va)) != 0) return v->addr + v->len;
+  return 0;
+}
+
+// Copy from user to kernel.
+// Copy len bytes to dst from virtual address srcva
+// in the current process.
+// Return 0 on success, -1 on error.
+int copyin_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
+  struct proc *p = myproc();
+
+  if (srcva + len < srcva || srcva + len > uend(p, srcva)) return -1;
+  ucopybegin(p);
+  memmove(dst, (void *)srcva, len);
+  return ucopyend(p);
+}
+
+// Copy a null-terminated string from user to kernel.
+// Copy bytes to dst from virtual address srcva
+// in the current process, until a '\0', or max.
+// Return 0 on success, -1 on error.
+int copyinstr_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
+  struct proc *p = myproc();
+  uint64 i, n;
+
+  if ((n = uend(p, srcva)) == 0) return -1;
+  n -= srcva;
+  if (n > max) n = max;
+  ucopybegin(p);
+  i = strnmove(dst, (char *)srcva, n);
+  if (ucopyend(p) != 0 || i == n) return -1;
+  return 0;
+}
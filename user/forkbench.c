@@ -0,0 +1,110 @@
+// Measure process creation and teardown with thousands of
+// processes alive. Forks n children (default NCHILD) that block
+// on a pipe, kills each one by pid, and waits for them all; then,
+// with another n blocked children still alive, times ROUNDS
+// fork/exit/wait round trips, which shouldn't get slower for
+// the crowd. Give it more memory ("make MEM=512M qemu") for
+// more children.
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NCHILD 2000
+#define ROUNDS 1000
+
+// ticks since start, at least 1.
+int since(int start) {
+  int t = uptime() - start;
+  return t > 0 ? t : 1;
+}
+
+// Fork up to n children that wait for go to be closed. Fills
+// in their pids and returns how many forks worked.
+int crowd(int *pids, int n, int go[2]) {
+  int i;
+  char c;
+
+  for (i = 0; i < n; i++) {
+    if ((pids[i] = fork()) < 0) break;
+    if (pids[i] == 0) {
+      close(go[1]);
+      read(go[0], &c, 1);
+      exit(0);
+    }
+  }
+  return i;
+}
+
+// Wait for n children.
+void reap(int n) {
+  for (; n > 0; n--) {
+    if (wait(0) < 0) {
+      printf("forkbench: wait stopped early\n");
+      exit(1);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int go[2], *pids, i, n, nchild, start, t, pid;
+  struct sysinfo info;
+
+  nchild = argc > 1 ? atoi(argv[1]) : NCHILD;
+  if (nchild < 1) nchild = 1;
+  if ((pids = malloc(nchild * sizeof(int))) == 0) {
+    printf("forkbench: out of memory\n");
+    exit(1);
+  }
+
+  if (pipe(go) < 0) {
+    printf("forkbench: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  n = crowd(pids, nchild, go);
+  t = since(start);
+  if (n < nchild) printf("forkbench: out of memory after %d forks\n", n);
+  if (sysinfo(&info) == 0) printf("forkbench: %l processes\n", info.nproc);
+  printf("forkbench: fork: %d in %d ticks, %d/tick\n", n, t, n / t);
+
+  start = uptime();
+  for (i = 0; i < n; i++) {
+    if (kill(pids[i]) < 0) {
+      printf("forkbench: kill %d failed\n", pids[i]);
+      exit(1);
+    }
+  }
+  t = since(start);
+  printf("forkbench: kill: %d in %d ticks, %d/tick\n", n, t, n / t);
+
+  start = uptime();
+  reap(n);
+  t = since(start);
+  printf("forkbench: wait: %d in %d ticks, %d/tick\n", n, t, n / t);
+  close(go[0]);
+  close(go[1]);
+
+  if (pipe(go) < 0) {
+    printf("forkbench: pipe failed\n");
+    exit(1);
+  }
+  n = crowd(pids, nchild, go);
+  start = uptime();
+  for (i = 0; i < ROUNDS; i++) {
+    if ((pid = fork()) < 0) {
+      printf("forkbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) exit(0);
+    if (wait(0) != pid) {
+      printf("forkbench: wait got the wrong child\n");
+      exit(1);
+    }
+  }
+  t = since(start);
+  printf("forkbench: fork+wait with %d others: %d in %d ticks, %d/tick\n", n, ROUNDS, t, ROUNDS / t);
+  close(go[1]);  // let the crowd go
+  reap(n);
+  exit(0);
+}
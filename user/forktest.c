@@ -1,11 +1,13 @@
-// Test that fork fails gracefully.
-// Tiny executable so that the limit can be filling the proc table.
+// Test that fork fails gracefully when there is no memory
+// left for another process.
+// Tiny executable so that the limit is the memory the
+// processes take, not what they copy.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-#define N 1000
+#define N 100000
 
 void print(const char *s) { write(1, s, strlen(s)); }
 
@@ -0,0 +1,64 @@
+// Measure page allocator throughput.
+// Several processes grow and shrink their heaps in parallel,
+// so every page goes through kalloc() and kfree().
+// Run it under "make CPUS=n qemu" for n = 1..8 to see how
+// throughput scales with the number of harts.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NCHILD 8
+#define NPAGES 64
+#define ROUNDS 200
+
+void churn(void) {
+  char *a;
+  int i, j;
+
+  for (i = 0; i < ROUNDS; i++) {
+    a = sbrk(NPAGES * 4096);
+    if (a == (char *)-1) {
+      printf("kallocbench: sbrk failed\n");
+      exit(1);
+    }
+    // touch each page, in case allocation is lazy.
+    for (j = 0; j < NPAGES; j++) a[j * 4096] = j;
+    if (sbrk(-NPAGES * 4096) == (char *)-1) {
+      printf("kallocbench: sbrk shrink failed\n");
+      exit(1);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int n, nchild, xstatus, start, elapsed;
+  int fail = 0;
+
+  nchild = NCHILD;
+  if (argc > 1) nchild = atoi(argv[1]);
+  if (nchild < 1) nchild = 1;
+
+  start = uptime();
+  for (n = 0; n < nchild; n++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("kallocbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      churn();
+      exit(0);
+    }
+  }
+  for (n = 0; n < nchild; n++) {
+    wait(&xstatus);
+    if (xstatus != 0) fail = 1;
+  }
+  elapsed = uptime() - start;
+  if (elapsed == 0) elapsed = 1;
+
+  printf("kallocbench: %d procs, %d pages in %d ticks, %d pages/tick\n", nchild, nchild * ROUNDS * NPAGES, elapsed,
+         nchild * ROUNDS * NPAGES / elapsed);
+  exit(fail);
+}
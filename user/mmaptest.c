@@ -0,0 +1,216 @@
+//
+// tests for mmap() and munmap().
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define FILESZ (2 * PGSIZE + PGSIZE / 2)  // ends in the middle of a page
+#define MAP_FAILED ((char *)0xffffffffffffffffL)
+
+char buf[PGSIZE];
+
+void err(char *why) {
+  printf("mmaptest: %s failed (pid %d)\n", why, getpid());
+  exit(1);
+}
+
+// create f, FILESZ bytes of 'A'.
+void makefile(const char *f) {
+  int fd, i;
+
+  unlink(f);
+  if ((fd = open(f, O_WRONLY | O_CREATE)) < 0) err("open");
+  memset(buf, 'A', PGSIZE);
+  for (i = 0; i < FILESZ; i += PGSIZE)
+    if (write(fd, buf, FILESZ - i < PGSIZE ? FILESZ - i : PGSIZE) < 0) err("write");
+  close(fd);
+}
+
+// check that the FILESZ bytes at p are c, and that the
+// rest of the last page is zero.
+void checkmem(char *p, char c) {
+  for (int i = 0; i < PGROUNDUP(FILESZ); i++) {
+    if (p[i] != (i < FILESZ ? c : 0)) {
+      printf("mmaptest: byte %d is %d, not %d\n", i, p[i], i < FILESZ ? c : 0);
+      err("checkmem");
+    }
+  }
+}
+
+// check that file f holds FILESZ bytes, the first n of which
+// are c and the rest 'A'.
+void checkfile(const char *f, char c, int n) {
+  struct stat st;
+  int fd, i, m, off = 0;
+
+  if ((fd = open(f, O_RDONLY)) < 0) err("open");
+  if (fstat(fd, &st) < 0 || st.size != FILESZ) err("file size");
+  while ((m = read(fd, buf, PGSIZE)) > 0) {
+    for (i = 0; i < m; i++, off++)
+      if (buf[i] != (off < n ? c : 'A')) err("file content");
+  }
+  close(fd);
+}
+
+// run f in a child and expect it to be killed.
+void killed(void (*f)(char *), char *p, char *why) {
+  int pid, xstatus;
+
+  if ((pid = fork()) < 0) err("fork");
+  if (pid == 0) {
+    f(p);
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != -1) err(why);
+}
+
+void store(char *p) { *p = 'X'; }
+void load(char *p) {
+  volatile char c = *p;
+  (void)c;
+}
+
+void mmaptest(void) {
+  const char *f = "mmap.dur";
+  char *p, *q;
+  int fd;
+
+  printf("mmap: ");
+  makefile(f);
+  if ((fd = open(f, O_RDONLY)) < 0) err("open");
+
+  // a read-only private mapping sees the file, and zeros past its end.
+  if ((p = mmap(0, PGSIZE * 3, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) err("mmap (1)");
+  checkmem(p, 'A');
+  killed(store, p, "store to PROT_READ page");
+  if (munmap(p, PGSIZE * 3) < 0) err("munmap (1)");
+
+  // a private writable mapping of a read-only file is fine,
+  // but its writes don't reach the file.
+  if ((p = mmap(0, PGSIZE * 3, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) err("mmap (2)");
+  memset(p, 'B', FILESZ);
+  checkmem(p, 'B');
+  if (munmap(p, PGSIZE * 3) < 0) err("munmap (2)");
+  checkfile(f, 'B', 0);
+
+  // a shared writable mapping needs a writable file.
+  if (mmap(0, PGSIZE * 3, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED) err("mmap of read-only file");
+  close(fd);
+
+  // writes to a shared mapping reach the file on munmap(),
+  // part by part, without making the file longer.
+  if ((fd = open(f, O_RDWR)) < 0) err("open");
+  if ((p = mmap(0, PGSIZE * 3, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) err("mmap (3)");
+  close(fd);  // the mapping keeps the file open
+  memset(p, 'C', FILESZ);
+  if (munmap(p, PGSIZE) < 0) err("munmap (3)");
+  checkfile(f, 'C', PGSIZE);
+  killed(load, p, "load from unmapped page");
+  if (munmap(p + PGSIZE, PGSIZE * 2) < 0) err("munmap (4)");
+  checkfile(f, 'C', FILESZ);
+
+  // a hole in the middle of a mapping; two mappings at once.
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) < 0) err("open");
+  if ((p = mmap(0, PGSIZE * 3, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) err("mmap (5)");
+  if ((q = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, PGSIZE)) == MAP_FAILED) err("mmap (6)");
+  close(fd);
+  if (q[0] != 'A') err("second mapping");
+  if (munmap(p + PGSIZE, PGSIZE) < 0) err("munmap (5)");
+  killed(load, p + PGSIZE, "load from hole");
+  p[0] = 'D';
+  p[2 * PGSIZE] = 'D';
+  if (munmap(p, PGSIZE) < 0 || munmap(p + 2 * PGSIZE, PGSIZE) < 0) err("munmap (6)");
+  if (munmap(q, PGSIZE) < 0) err("munmap (7)");
+  if ((fd = open(f, O_RDONLY)) < 0) err("open");
+  if (read(fd, buf, 1) != 1 || buf[0] != 'D') err("first page written back");
+  close(fd);
+
+  if (unlink(f) < 0) err("unlink");
+  printf("ok\n");
+}
+
+void forktest(void) {
+  const char *f = "mmap.dur";
+  int fd, pid, xstatus;
+  char *p, *q;
+
+  printf("fork: ");
+  makefile(f);
+  if ((fd = open(f, O_RDONLY)) < 0) err("open");
+  if ((p = mmap(0, PGSIZE * 3, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) err("mmap (1)");
+  close(fd);
+  if ((q = mmap(0, PGSIZE * 2, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    err("mmap (2)");
+  q[0] = 1;
+
+  if ((pid = fork()) < 0) err("fork");
+  if (pid == 0) {
+    // the child has the same mappings.
+    checkmem(p, 'A');
+    memset(p, 'E', FILESZ);  // private: the parent won't see it
+    q[0] = 2;                // shared: the parent will
+    q[PGSIZE] = 3;           // including pages nobody touched before fork
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) exit(1);
+  checkmem(p, 'A');
+  if (q[0] != 2 || q[PGSIZE] != 3) err("shared anonymous memory");
+  if (munmap(p, PGSIZE * 3) < 0 || munmap(q, PGSIZE * 2) < 0) err("munmap");
+
+  if (unlink(f) < 0) err("unlink");
+  printf("ok\n");
+}
+
+// system calls that copy to and from mapped pages.
+void syscalltest(void) {
+  const char *f = "mmap.dur", *tmp = "mmap.tmp";
+  int fd, fd2, n = FILESZ - 2 * PGSIZE;
+  char *p;
+
+  printf("syscalls: ");
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) < 0) err("open");
+  if ((p = mmap(0, PGSIZE * 3, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) err("mmap");
+  close(fd);
+
+  // copyin() from a page not yet read in.
+  if ((fd2 = open(tmp, O_RDWR | O_CREATE | O_TRUNC)) < 0) err("open");
+  if (write(fd2, p + PGSIZE, PGSIZE) != PGSIZE) err("write from mapping");
+  close(fd2);
+  if ((fd2 = open(tmp, O_RDWR)) < 0) err("open");
+  if (read(fd2, buf, PGSIZE) != PGSIZE) err("read");
+  for (int i = 0; i < PGSIZE; i++)
+    if (buf[i] != 'A') err("content written from mapping");
+  close(fd2);
+
+  // copyout() into the mapping must reach the file too.
+  if ((fd2 = open(tmp, O_RDWR | O_TRUNC)) < 0) err("open");
+  memset(buf, 'F', n);
+  if (write(fd2, buf, n) != n) err("write");
+  close(fd2);
+  if ((fd2 = open(tmp, O_RDONLY)) < 0) err("open");
+  memset(p, 'F', 2 * PGSIZE);
+  if (read(fd2, p + 2 * PGSIZE, n) != n) err("read into mapping");
+  close(fd2);
+  if (munmap(p, PGSIZE * 3) < 0) err("munmap");
+  checkfile(f, 'F', FILESZ);
+
+  if (unlink(f) < 0 || unlink(tmp) < 0) err("unlink");
+  printf("ok\n");
+}
+
+int main(int argc, char *argv[]) {
+  mmaptest();
+  forktest();
+  syscalltest();
+  printf("mmaptest: all tests succeeded\n");
+  exit(0);
+}
@@ -0,0 +1,27 @@
+// Run a command with a nice value: from -20, for the
+// most cpu, to 19, for the least. 10 if none is given.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int main(int argc, char *argv[]) {
+  int nice = 10;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    nice = argv[2][0] == '-' ? -atoi(argv[2] + 1) : atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc < 2) {
+    fprintf(2, "usage: nice [-n nice] command [arg ...]\n");
+    exit(1);
+  }
+  if (setpriority(0, nice) < 0) {
+    fprintf(2, "nice: bad nice value %d\n", nice);
+    exit(1);
+  }
+  exec(argv[1], argv + 1);
+  fprintf(2, "nice: exec %s failed\n", argv[1]);
+  exit(1);
+}
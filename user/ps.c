@@ -0,0 +1,32 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+// sizes in kilobytes
+#define KB(n) ((n) / 1024)
+#define PGKB(n) ((n) * (PGSIZE / 1024))
+
+static char *states[] = {"unused", "used", "sleep", "runble", "run", "zombie"};
+
+int main(int argc, char *argv[]) {
+  struct procinfo *pi;
+  struct sysinfo si;
+  int i, n;
+
+  // with room for processes that start meanwhile.
+  if (sysinfo(&si) < 0 || (pi = malloc((si.nproc + 16) * sizeof(*pi))) == 0 ||
+      (n = procinfo(pi, si.nproc + 16)) < 0) {
+    fprintf(2, "ps: failed\n");
+    exit(1);
+  }
+  printf("%l procs, %lK of %lK free, %lK swap free, %lK text (%lK shared)\n", si.nproc, KB(si.freemem),
+         KB(si.totalmem), KB(si.freeswap), PGKB(si.ntext), PGKB(si.ntextshared));
+  printf("%lK kernel page tables, %l TLB flushes, %l of one ASID\n", PGKB(si.kptpages), si.ntlbflush, si.nasidflush);
+  printf("PID\tSTATE\tPRI\tNI\tSZ\tRSS\tWS\tSWAP\tPT\tNAME\n");
+  for (i = 0; i < n; i++)
+    printf("%d\t%s\t%d\t%d\t%lK\t%lK\t%lK\t%lK\t%lK\t%s\n", pi[i].pid, states[pi[i].state], pi[i].prio, pi[i].nice,
+           KB(pi[i].sz), PGKB(pi[i].rss), PGKB(pi[i].wss), PGKB(pi[i].swapped), PGKB(pi[i].ptpages), pi[i].name);
+  exit(0);
+}
@@ -0,0 +1,156 @@
+// Measure the scheduler.
+// "pingpong": pairs of processes bounce a byte back and forth
+// over pipes, so nearly all their time goes to sleeping,
+// waking up and switching: context-switch throughput.
+// "spin": more CPU-bound processes than harts count as fast as
+// they can; the count, against what one process gets alone on
+// each hart, shows what scheduling costs them.
+// Run it under "make CPUS=n qemu" for n = 1..8 to see how
+// both scale with the number of harts.
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NPAIR 4
+#define ROUNDS 2000
+#define NSPIN 16
+#define SPINTICKS 20
+
+void sinfo(struct sysinfo *info) {
+  if (sysinfo(info) < 0) {
+    printf("schedbench: sysinfo failed\n");
+    exit(1);
+  }
+}
+
+// Bounce a byte ROUNDS times between this process
+// and a child, over two pipes.
+void pingpong(void) {
+  int ping[2], pong[2], i, pid, xstatus;
+  char c = 0;
+
+  if (pipe(ping) < 0 || pipe(pong) < 0) {
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  if ((pid = fork()) < 0) {
+    printf("schedbench: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    for (i = 0; i < ROUNDS; i++) {
+      if (read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1) exit(1);
+    }
+    exit(0);
+  }
+  for (i = 0; i < ROUNDS; i++) {
+    if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1) {
+      printf("schedbench: pingpong lost a byte\n");
+      exit(1);
+    }
+  }
+  wait(&xstatus);
+  exit(xstatus);
+}
+
+// Wait on go until it is closed, then count for SPINTICKS
+// ticks and write the count to out.
+void spin(int go, int out) {
+  volatile uint64 n = 0;
+  int i, start;
+  char c;
+
+  read(go, &c, 1);
+  start = uptime();
+  while (uptime() - start < SPINTICKS)
+    for (i = 0; i < 1000; i++) n++;
+  write(out, (void *)&n, sizeof(n));
+  exit(0);
+}
+
+// Start nspin spinners together and return their total count.
+uint64 spinners(int nspin) {
+  int go[2], out[2], i, xstatus;
+  uint64 n, total = 0;
+
+  if (pipe(go) < 0 || pipe(out) < 0) {
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  for (i = 0; i < nspin; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      close(go[1]);
+      close(out[0]);
+      spin(go[0], out[1]);
+    }
+  }
+  close(go[0]);
+  close(out[1]);
+  close(go[1]);  // off they go
+  for (i = 0; i < nspin; i++) {
+    if (read(out[0], &n, sizeof(n)) != sizeof(n)) {
+      printf("schedbench: spinner lost\n");
+      exit(1);
+    }
+    total += n;
+  }
+  close(out[0]);
+  for (i = 0; i < nspin; i++) {
+    wait(&xstatus);
+    if (xstatus != 0) exit(1);
+  }
+  return total;
+}
+
+int main(int argc, char *argv[]) {
+  struct sysinfo before, after;
+  int n, npair, nspin, xstatus, start, elapsed;
+  uint64 one, all, ncpu;
+
+  npair = argc > 1 ? atoi(argv[1]) : NPAIR;
+  nspin = argc > 2 ? atoi(argv[2]) : NSPIN;
+  if (npair < 1) npair = 1;
+  if (nspin < 1) nspin = 1;
+
+  sinfo(&before);
+  ncpu = before.ncpu;
+  start = uptime();
+  for (n = 0; n < npair; n++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) pingpong();
+  }
+  for (n = 0; n < npair; n++) {
+    wait(&xstatus);
+    if (xstatus != 0) {
+      printf("schedbench: pingpong failed\n");
+      exit(1);
+    }
+  }
+  elapsed = uptime() - start;
+  if (elapsed == 0) elapsed = 1;
+  sinfo(&after);
+  printf("schedbench: %l cpus, pingpong: %d pairs, %d round trips in %d ticks, %d/tick\n", ncpu, npair,
+         npair * ROUNDS, elapsed, npair * ROUNDS / elapsed);
+  printf("schedbench: pingpong: %l switches, %l/tick, %l stolen\n", after.nswitch - before.nswitch,
+         (after.nswitch - before.nswitch) / elapsed, after.nsteal - before.nsteal);
+
+  one = spinners(1);
+  sinfo(&before);
+  all = spinners(nspin);
+  sinfo(&after);
+  if (one == 0) one = 1;
+  printf("schedbench: spin: 1 proc %l, %d procs %l, %l%% of 1 per cpu\n", one / SPINTICKS, nspin, all / SPINTICKS,
+         all * 100 / (one * (nspin < ncpu ? nspin : ncpu)));
+  printf("schedbench: spin: %l switches, %l stolen\n", after.nswitch - before.nswitch, after.nsteal - before.nsteal);
+  exit(0);
+}
@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC 1
@@ -12,6 +13,7 @@
 #define BACK 5
 
 #define MAXARGS 10
+#define MAXFA (MAXSPAWNFA + 1)  // file actions for one spawn(), with SPAWN_END
 
 struct cmd {
   int type;
@@ -52,6 +54,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char *);
 struct cmd *parsecmd(char *);
+void freecmd(struct cmd *);
 
 // Execute cmd.  Never returns.
 void runcmd(struct cmd *cmd) {
@@ -123,6 +126,74 @@ void runcmd(struct cmd *cmd) {
   exit(0);
 }
 
+// Can spawncmd() run cmd, given nfa file actions already?
+// It can run a command, possibly redirected, or a pipeline of
+// them; anything else needs runcmd() in a forked shell.
+int spawnable(struct cmd *cmd, int nfa) {
+  if (nfa + 3 >= MAXFA) return 0;
+  switch (cmd->type) {
+    case EXEC:
+      return 1;
+    case REDIR:
+      return spawnable(((struct redircmd *)cmd)->cmd, nfa + 2);
+    case PIPE:
+      return spawnable(((struct pipecmd *)cmd)->left, nfa + 3) && spawnable(((struct pipecmd *)cmd)->right, nfa + 3);
+  }
+  return 0;
+}
+
+// Start cmd with spawn(), so the shell's memory isn't copied
+// only to be thrown away, giving each process the file actions
+// fa[0..nfa) before its own. cmd must be spawnable().
+// Returns the number of processes started.
+int spawncmd(struct cmd *cmd, struct spawnfa *fa, int nfa) {
+  int p[2], fd, n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch (cmd->type) {
+    default:
+      panic("spawncmd");
+
+    case EXEC:
+      ecmd = (struct execcmd *)cmd;
+      if (ecmd->argv[0] == 0) return 0;
+      fa[nfa].op = SPAWN_END;
+      if (spawn(ecmd->argv[0], ecmd->argv, fa) < 0) {
+        fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+        return 0;
+      }
+      return 1;
+
+    case REDIR:
+      rcmd = (struct redircmd *)cmd;
+      if ((fd = open(rcmd->file, rcmd->mode)) < 0) {
+        fprintf(2, "open %s failed\n", rcmd->file);
+        return 0;
+      }
+      fa[nfa] = (struct spawnfa){SPAWN_DUP2, fd, rcmd->fd};
+      fa[nfa + 1] = (struct spawnfa){SPAWN_CLOSE, fd, 0};
+      n = spawncmd(rcmd->cmd, fa, nfa + 2);
+      close(fd);
+      return n;
+
+    case PIPE:
+      pcmd = (struct pipecmd *)cmd;
+      if (pipe(p) < 0) panic("pipe");
+      fa[nfa] = (struct spawnfa){SPAWN_DUP2, p[1], 1};
+      fa[nfa + 1] = (struct spawnfa){SPAWN_CLOSE, p[0], 0};
+      fa[nfa + 2] = (struct spawnfa){SPAWN_CLOSE, p[1], 0};
+      n = spawncmd(pcmd->left, fa, nfa + 3);
+      fa[nfa] = (struct spawnfa){SPAWN_DUP2, p[0], 0};
+      n += spawncmd(pcmd->right, fa, nfa + 3);
+      close(p[0]);
+      close(p[1]);
+      return n;
+  }
+  return 0;
+}
+
 int getcmd(char *buf, int nbuf) {
   fprintf(2, "$ ");
   memset(buf, 0, nbuf);
@@ -135,7 +206,9 @@ int getcmd(char *buf, int nbuf) {
 int main(void) {
   printf("[220110419] start sh through execve\n");
   static char buf[100];
-  int fd;
+  struct spawnfa fa[MAXFA];
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while ((fd = open("console", O_RDWR)) >= 0) {
@@ -153,8 +226,15 @@ int main(void) {
       if (chdir(buf + 3) < 0) fprintf(2, "cannot cd %s\n", buf + 3);
       continue;
     }
-    if (fork1() == 0) runcmd(parsecmd(buf));
-    wait(0);
+    if ((cmd = parsecmd(buf)) == 0) continue;
+    if (spawnable(cmd, 0)) {
+      n = spawncmd(cmd, fa, 0);
+    } else {
+      if (fork1() == 0) runcmd(cmd);
+      n = 1;
+    }
+    while (n-- > 0) wait(0);
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -282,6 +362,14 @@ int peek(char **ps, char *es, char *toks) {
   return *s && strchr(toks, *s);
 }
 
+int parseerr;  // set on a syntax error
+
+// Report a syntax error; parsecmd() will return 0.
+void syntax(char *s) {
+  if (!parseerr) fprintf(2, "%s\n", s);
+  parseerr = 1;
+}
+
 struct cmd *parseline(char **, char *);
 struct cmd *parsepipe(char **, char *);
 struct cmd *parseexec(char **, char *);
@@ -292,11 +380,16 @@ struct cmd *parsecmd(char *s) {
   struct cmd *cmd;
 
   es = s + strlen(s);
+  parseerr = 0;
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if (s != es) {
+  if (s != es && !parseerr) {
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if (parseerr) {
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -334,7 +427,10 @@ struct cmd *parseredirs(struct cmd *cmd, char **ps, char *es) {
 
   while (peek(ps, es, "<>")) {
     tok = gettoken(ps, es, 0, 0);
-    if (gettoken(ps, es, &q, &eq) != 'a') panic("missing file for redirection");
+    if (gettoken(ps, es, &q, &eq) != 'a') {
+      syntax("missing file for redirection");
+      return cmd;
+    }
     switch (tok) {
       case '<':
         cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -356,7 +452,10 @@ struct cmd *parseblock(char **ps, char *es) {
   if (!peek(ps, es, "(")) panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if (!peek(ps, es, ")")) panic("syntax - missing )");
+  if (!peek(ps, es, ")")) {
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -377,11 +476,17 @@ struct cmd *parseexec(char **ps, char *es) {
   ret = parseredirs(ret, ps, es);
   while (!peek(ps, es, "|)&;")) {
     if ((tok = gettoken(ps, es, &q, &eq)) == 0) break;
-    if (tok != 'a') panic("syntax");
+    if (tok != 'a') {
+      syntax("syntax");
+      break;
+    }
+    if (argc >= MAXARGS - 1) {
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if (argc >= MAXARGS) panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -431,3 +536,29 @@ struct cmd *nulterminate(struct cmd *cmd) {
   }
   return cmd;
 }
+
+// Free cmd and the commands in it.
+void freecmd(struct cmd *cmd) {
+  if (cmd == 0) return;
+
+  switch (cmd->type) {
+    case REDIR:
+      freecmd(((struct redircmd *)cmd)->cmd);
+      break;
+
+    case PIPE:
+      freecmd(((struct pipecmd *)cmd)->left);
+      freecmd(((struct pipecmd *)cmd)->right);
+      break;
+
+    case LIST:
+      freecmd(((struct listcmd *)cmd)->left);
+      freecmd(((struct listcmd *)cmd)->right);
+      break;
+
+    case BACK:
+      freecmd(((struct backcmd *)cmd)->cmd);
+      break;
+  }
+  free(cmd);
+}
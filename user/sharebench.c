@@ -0,0 +1,141 @@
+// Measure how the scheduler shares the cpu. One CPU-bound
+// process per nice value given (default 0 0 5 10) spins for
+// SPINTICKS ticks; each one's share of their total running
+// time is printed next to the share its nice weight entitles
+// it to under the fair-share scheduler (make SCHED=CFS).
+// The targets hold when the processes share one hart, so run
+// it under "make CPUS=1 qemu"; with more harts, each one is
+// shared fairly among the processes it runs, and moving between
+// them must not cost a process its place: sharebench fails if
+// one gets less than a quarter of its one-hart target.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/sysinfo.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+#define MAXSPIN 16
+#define SPINTICKS 50
+
+// The running time of the current process, in mtime cycles.
+uint64 runtime(void) {
+  struct procinfo *pi;
+  struct sysinfo info;
+  uint64 t;
+  int i, n, pid = getpid();
+
+  if (sysinfo(&info) < 0 || (pi = malloc(info.nproc * sizeof(*pi))) == 0) {
+    printf("sharebench: out of memory\n");
+    exit(1);
+  }
+  n = procinfo(pi, info.nproc);
+  for (i = 0; i < n; i++) {
+    if (pi[i].pid == pid) {
+      t = pi[i].runtime;
+      free(pi);
+      return t;
+    }
+  }
+  printf("sharebench: procinfo doesn't list pid %d\n", pid);
+  exit(1);
+}
+
+// Wait on go until it is closed, spin for SPINTICKS ticks,
+// and write the running time that took to out.
+void spin(int go, int out) {
+  uint64 t0, t;
+  int start;
+  char c;
+
+  read(go, &c, 1);
+  t0 = runtime();
+  start = uptime();
+  while (uptime() - start < SPINTICKS)
+    ;
+  t = runtime() - t0;
+  write(out, (void *)&t, sizeof(t));
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  int nice[MAXSPIN], go[2], out[MAXSPIN][2];
+  uint64 t[MAXSPIN], total = 0, weights = 0;
+  int i, n, xstatus;
+  char *s;
+
+  n = 0;
+  for (i = 1; i < argc && n < MAXSPIN; i++) {
+    s = argv[i];
+    nice[n] = s[0] == '-' ? -atoi(s + 1) : atoi(s);
+    if (nice[n] < NICEMIN || nice[n] > NICEMAX) {
+      fprintf(2, "sharebench: bad nice value %s\n", s);
+      exit(1);
+    }
+    n++;
+  }
+  if (n == 0) {
+    nice[n++] = 0;
+    nice[n++] = 0;
+    nice[n++] = 5;
+    nice[n++] = 10;
+  }
+
+  if (pipe(go) < 0) {
+    printf("sharebench: pipe failed\n");
+    exit(1);
+  }
+  for (i = 0; i < n; i++) {
+    if (pipe(out[i]) < 0) {
+      printf("sharebench: pipe failed\n");
+      exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+      printf("sharebench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      close(go[1]);
+      if (setpriority(0, nice[i]) < 0) exit(1);
+      spin(go[0], out[i][1]);
+    }
+    close(out[i][1]);
+  }
+  close(go[0]);
+  close(go[1]);  // off they go
+
+  for (i = 0; i < n; i++) {
+    if (read(out[i][0], &t[i], sizeof(t[i])) != sizeof(t[i])) {
+      printf("sharebench: spinner %d lost\n", i);
+      exit(1);
+    }
+    close(out[i][0]);
+    total += t[i];
+    weights += niceweight[nice[i] - NICEMIN];
+  }
+  for (i = 0; i < n; i++) {
+    wait(&xstatus);
+    if (xstatus != 0) {
+      printf("sharebench: spinner failed\n");
+      exit(1);
+    }
+  }
+  if (total == 0) total = 1;
+
+  printf("NICE\tWEIGHT\tTARGET\tGOT\n");
+  for (i = 0; i < n; i++) {
+    int w = niceweight[nice[i] - NICEMIN];
+    printf("%d\t%d\t%l.%l%%\t%l.%l%%\n", nice[i], w, w * 100 / weights, w * 1000 / weights % 10, t[i] * 100 / total,
+           t[i] * 1000 / total % 10);
+  }
+  // a process never gets less than its one-hart share
+  // on more harts, give or take.
+  for (i = 0; i < n; i++) {
+    if (t[i] * weights * 4 < niceweight[nice[i] - NICEMIN] * total) {
+      printf("sharebench: FAIL nice %d starved\n", nice[i]);
+      exit(1);
+    }
+  }
+  exit(0);
+}
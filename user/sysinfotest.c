@@ -0,0 +1,177 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+void sinfo(struct sysinfo *info) {
+  if (sysinfo(info) < 0) {
+    printf("FAIL: sysinfo failed\n");
+    exit(1);
+  }
+}
+
+void testmem() {
+  struct sysinfo info;
+  uint64 n0, n1;
+  char *a;
+
+  sinfo(&info);
+  n0 = info.freemem;
+  if (n0 == 0 || n0 > info.totalmem) {
+    printf("FAIL: free mem %l (bytes)\n", n0);
+    exit(1);
+  }
+
+  // sbrk() allocates nothing until the page is touched.
+  a = sbrk(PGSIZE);
+  if (a == (char *)0xffffffffffffffff) {
+    printf("sbrk failed");
+    exit(1);
+  }
+  sinfo(&info);
+  if (info.freemem != n0) {
+    printf("FAIL: free mem %l (bytes) instead of %l after sbrk\n", info.freemem, n0);
+    exit(1);
+  }
+
+  // the page, and maybe a page-table page for it.
+  a[PGSIZE - 1] = 1;
+  sinfo(&info);
+  n1 = info.freemem;
+  if (n1 != n0 - PGSIZE && n1 != n0 - 2 * PGSIZE) {
+    printf("FAIL: free mem %l (bytes) instead of %l after touching a page\n", n1, n0 - PGSIZE);
+    exit(1);
+  }
+
+  if ((uint64)sbrk(-PGSIZE) == 0xffffffffffffffff) {
+    printf("sbrk failed");
+    exit(1);
+  }
+  sinfo(&info);
+  if (info.freemem != n1 + PGSIZE) {
+    printf("FAIL: free mem %l (bytes) instead of %l after freeing a page\n", info.freemem, n1 + PGSIZE);
+    exit(1);
+  }
+}
+
+void testcall() {
+  struct sysinfo info;
+
+  if (sysinfo(&info) < 0) {
+    printf("FAIL: sysinfo failed\n");
+    exit(1);
+  }
+
+  if (sysinfo((struct sysinfo *)0xeaeb0b5b00002f5e) != 0xffffffffffffffff) {
+    printf("FAIL: sysinfo succeeded with bad argument\n");
+    exit(1);
+  }
+}
+
+void testproc() {
+  struct sysinfo info;
+  uint64 nproc;
+  int status;
+  int pid;
+
+  sinfo(&info);
+  nproc = info.nproc;
+
+  pid = fork();
+  if (pid < 0) {
+    printf("sysinfotest: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    sinfo(&info);
+    if (info.nproc != nproc + 1) {
+      printf("sysinfotest: FAIL nproc is %l instead of %l\n", info.nproc, nproc + 1);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&status);
+  sinfo(&info);
+  if (info.nproc != nproc) {
+    printf("sysinfotest: FAIL nproc is %l instead of %l\n", info.nproc, nproc);
+    exit(1);
+  }
+}
+
+void testcache() {
+  struct sysinfo info;
+  uint64 ninode;
+  int fd;
+
+  sinfo(&info);
+  if (info.bcachesize < NBUF || info.bcachesize > NBUFMAX) {
+    printf("sysinfotest: FAIL bcachesize is %l\n", info.bcachesize);
+    exit(1);
+  }
+  if (info.nbuf == 0 || info.nbuf > info.bcachesize) {
+    printf("sysinfotest: FAIL nbuf is %l\n", info.nbuf);
+    exit(1);
+  }
+  ninode = info.ninode;
+
+  // an open file keeps its inode in the cache.
+  if ((fd = open("sysinfo.tmp", O_CREATE | O_RDWR)) < 0) {
+    printf("sysinfotest: open failed\n");
+    exit(1);
+  }
+  sinfo(&info);
+  if (info.ninode != ninode + 1) {
+    printf("sysinfotest: FAIL ninode is %l instead of %l\n", info.ninode, ninode + 1);
+    exit(1);
+  }
+  close(fd);
+  unlink("sysinfo.tmp");
+  sinfo(&info);
+  if (info.ninode != ninode) {
+    printf("sysinfotest: FAIL ninode is %l instead of %l\n", info.ninode, ninode);
+    exit(1);
+  }
+}
+
+void testprocinfo() {
+  struct procinfo *pi;
+  struct sysinfo info;
+  int i, n, pid = getpid();
+  char *a;
+
+  // a megabyte of memory this process has touched.
+  a = sbrk(1024 * 1024);
+  for (i = 0; i < 1024 * 1024; i += PGSIZE) a[i] = 1;
+
+  sinfo(&info);
+  if ((pi = malloc(info.nproc * sizeof(*pi))) == 0) {
+    printf("sysinfotest: FAIL malloc\n");
+    exit(1);
+  }
+  n = procinfo(pi, info.nproc);
+  for (i = 0; i < n; i++)
+    if (pi[i].pid == pid) break;
+  if (i == n) {
+    printf("sysinfotest: FAIL procinfo doesn't list pid %d\n", pid);
+    exit(1);
+  }
+  if (pi[i].sz != (uint64)sbrk(0) || pi[i].rss + pi[i].swapped < 1024 * 1024 / PGSIZE || pi[i].ptpages < 4) {
+    printf("sysinfotest: FAIL procinfo: sz %l rss %l swapped %l ptpages %l\n", pi[i].sz, pi[i].rss, pi[i].swapped,
+           pi[i].ptpages);
+    exit(1);
+  }
+  sbrk(-1024 * 1024);
+}
+
+int main(int argc, char *argv[]) {
+  printf("sysinfotest: start\n");
+  testcall();
+  testmem();
+  testproc();
+  testcache();
+  testprocinfo();
+  printf("sysinfotest: OK\n");
+  exit(0);
+}
@@ -1,4 +1,7 @@
 struct stat;
+struct sysinfo;
+struct procinfo;
+struct spawnfa;
 struct rtcdate;
 
 // system calls
@@ -23,6 +26,16 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void *mmap(void *, uint64, int, int, int, uint64);
+int munmap(void *, uint64);
+int shmget(int, uint64);
+void *shmat(int);
+int shmdt(void *);
+int sysinfo(struct sysinfo *);
+int procinfo(struct procinfo *, int);
+int spawn(char*, char**, struct spawnfa*);
+int pgaccess(void*, int, void*);
+int setpriority(int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
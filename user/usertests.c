@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/spawn.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -64,6 +66,55 @@ void copyin(char *s) {
   }
 }
 
+// system calls that read heap pages the process has never
+// touched: the kernel must bring them in, zeroed, just as
+// a user load would.
+void copyinlazy(char *s) {
+  char *a, buf[PGSIZE];
+  int fds[2], fd, i;
+
+  a = sbrk(4 * PGSIZE);
+  if (a == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char *)PGROUNDUP((uint64)a);
+  if (pipe(fds) < 0) {
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if (write(fds[1], a + PGSIZE, PGSIZE) != PGSIZE) {
+    printf("%s: write from untouched page failed\n", s);
+    exit(1);
+  }
+  if (read(fds[0], buf, PGSIZE) != PGSIZE) {
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < PGSIZE; i++) {
+    if (buf[i] != 0) {
+      printf("%s: untouched page isn't zero\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // a file name whose terminating zero is on the next,
+  // untouched, page.
+  a[2 * PGSIZE - 1] = 'z';
+  fd = open(a + 2 * PGSIZE - 1, O_CREATE | O_WRONLY);
+  if (fd < 0) {
+    printf("%s: open(\"z\") failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if (unlink("z") < 0) {
+    printf("%s: unlink(\"z\") failed\n", s);
+    exit(1);
+  }
+}
+
 // what if you pass ridiculous pointers to system calls
 // that write user memory with copyout?
 void copyout(char *s) {
@@ -641,6 +692,174 @@ void exectest(char *s) {
   }
 }
 
+// spawn() a child with its output redirected by file actions,
+// as sh does, and check that bad actions make spawn() fail.
+void spawntest(char *s) {
+  int fd, xstatus, pid, i;
+  char *echoargv[] = {"echo", "OK", 0};
+  char buf[3];
+  struct spawnfa fa[3], many[MAXSPAWNFA + 2];
+
+  unlink("echo-ok");
+  fd = open("echo-ok", O_CREATE | O_WRONLY);
+  if (fd < 0) {
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fa[0] = (struct spawnfa){SPAWN_DUP2, fd, 1};
+  fa[1] = (struct spawnfa){SPAWN_CLOSE, fd, 0};
+  fa[2] = (struct spawnfa){SPAWN_END, 0, 0};
+  if ((pid = spawn("echo", echoargv, fa)) < 0) {
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if (wait(&xstatus) != pid || xstatus != 0) {
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  fd = open("echo-ok", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if (read(fd, buf, 2) != 2) {
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("echo-ok");
+  if (buf[0] != 'O' || buf[1] != 'K') {
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if (spawn("nonexistent", echoargv, 0) >= 0) {
+    printf("%s: spawn nonexistent succeeded\n", s);
+    exit(1);
+  }
+  // fd 1 was closed by the first action.
+  fa[0] = (struct spawnfa){SPAWN_CLOSE, 1, 0};
+  fa[1] = (struct spawnfa){SPAWN_DUP2, 1, 2};
+  if (spawn("echo", echoargv, fa) >= 0) {
+    printf("%s: spawn with a bad action succeeded\n", s);
+    exit(1);
+  }
+  if (spawn("echo", echoargv, (struct spawnfa *)0xeaeb0b5b00002f5e) >= 0) {
+    printf("%s: spawn with bad actions pointer succeeded\n", s);
+    exit(1);
+  }
+  // harmless actions, but more of them than spawn() takes.
+  for (i = 0; i < MAXSPAWNFA + 1; i++) many[i] = (struct spawnfa){SPAWN_DUP2, 0, 0};
+  many[i] = (struct spawnfa){SPAWN_END, 0, 0};
+  if (spawn("echo", echoargv, many) >= 0) {
+    printf("%s: spawn with too many actions succeeded\n", s);
+    exit(1);
+  }
+  if (wait(0) != -1) {
+    printf("%s: a failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// two processes running the same program share its text,
+// which is read-only, and its file can't be written while
+// they run.
+void sharedtext(char *s) {
+  struct sysinfo before, after;
+  char *catargv[] = {"cat", 0};
+  struct spawnfa fa[4];
+  int fds[2], fd, i, pid, xstatus;
+
+  if (pipe(fds) < 0) {
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if (sysinfo(&before) < 0) {
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  // two cats, waiting to read from the pipe.
+  fa[0] = (struct spawnfa){SPAWN_DUP2, fds[0], 0};
+  fa[1] = (struct spawnfa){SPAWN_CLOSE, fds[0], 0};
+  fa[2] = (struct spawnfa){SPAWN_CLOSE, fds[1], 0};
+  fa[3] = (struct spawnfa){SPAWN_END, 0, 0};
+  for (i = 0; i < 2; i++) {
+    if (spawn("cat", catargv, fa) < 0) {
+      printf("%s: spawn cat failed\n", s);
+      exit(1);
+    }
+  }
+  sleep(5);
+  if (sysinfo(&after) < 0) {
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if ((fd = open("cat", O_WRONLY)) >= 0 || (fd = open("cat", O_RDONLY | O_TRUNC)) >= 0) {
+    printf("%s: opened a running program to write it\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for (i = 0; i < 2; i++) {
+    if (wait(&xstatus) < 0 || xstatus != 0) {
+      printf("%s: cat failed\n", s);
+      exit(1);
+    }
+  }
+  if ((fd = open("cat", O_WRONLY)) < 0) {
+    printf("%s: can't open a program no one runs to write it\n", s);
+    exit(1);
+  }
+  close(fd);
+  if (after.ntextshared <= before.ntextshared) {
+    printf("%s: no text shared: %d pages before, %d after\n", s, (int)before.ntextshared, (int)after.ntextshared);
+    exit(1);
+  }
+
+  // writing to text must kill the writer.
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    *(volatile char *)sharedtext = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != -1) {
+    printf("%s: write to text didn't kill the writer\n", s);
+    exit(1);
+  }
+}
+
+// a pipe read() into a bad address shouldn't use up the data.
+void pipebadread(char *s) {
+  int fds[2];
+  char b[8];
+
+  if (pipe(fds) < 0) {
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if (write(fds[1], "hello", 5) != 5) {
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if (read(fds[0], (char *)0xeaeb0b5b00002f5e, 5) > 0) {
+    printf("%s: read into a bad address succeeded\n", s);
+    exit(1);
+  }
+  if (read(fds[0], b, sizeof(b)) != 5 || memcmp(b, "hello", 5) != 0) {
+    printf("%s: data lost after a bad read\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
 // simple fork and pipe read/write
 
 void pipe1(char *s) {
@@ -692,6 +911,182 @@ void pipe1(char *s) {
   }
 }
 
+#define STREAMSZ (64 * 1024 * 1024)
+#define RINGSZ (64 * PGSIZE)
+
+// stream STREAMSZ bytes from a child to its parent, first
+// through a ring buffer in shared memory, then through a pipe.
+void shmstream(char *s) {
+  volatile uint64 *ctl;  // bytes written to, and read from, the ring
+  uint64 *ring, *w = (uint64 *)buf, i, n, m;
+  int id, pid, fds[2], xstatus, t0, tshm, r;
+
+  if ((id = shmget(0, PGSIZE + RINGSZ)) < 0) {
+    printf("%s: shmget failed\n", s);
+    exit(1);
+  }
+  if ((ctl = shmat(id)) == (void *)-1) {
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  ring = (uint64 *)((char *)ctl + PGSIZE);
+  t0 = uptime();
+  if ((pid = fork()) < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    // the child inherits the attachment.
+    for (n = 0; n < STREAMSZ; n += PGSIZE) {
+      while (n - ctl[1] >= RINGSZ)
+        ;
+      for (i = 0; i < PGSIZE / 8; i++) ring[(n % RINGSZ) / 8 + i] = n / 8 + i;
+      __sync_synchronize();
+      ctl[0] = n + PGSIZE;
+    }
+    exit(0);
+  }
+  for (n = 0; n < STREAMSZ; n += PGSIZE) {
+    while (ctl[0] == n)
+      ;
+    __sync_synchronize();
+    for (i = 0; i < PGSIZE / 8; i++) {
+      if (ring[(n % RINGSZ) / 8 + i] != n / 8 + i) {
+        printf("%s: wrong data at %p through shared memory\n", s, n + 8 * i);
+        exit(1);
+      }
+    }
+    __sync_synchronize();
+    ctl[1] = n + PGSIZE;
+  }
+  wait(&xstatus);
+  if (xstatus != 0) exit(1);
+  tshm = uptime() - t0;
+  if (shmdt((void *)ctl) < 0) {
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+  // the segment went away with its last attachment.
+  if (shmat(id) != (void *)-1) {
+    printf("%s: shmat after last shmdt succeeded\n", s);
+    exit(1);
+  }
+
+  if (pipe(fds) < 0) {
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  if ((pid = fork()) < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    for (n = 0; n < STREAMSZ; n += PGSIZE) {
+      for (i = 0; i < PGSIZE / 8; i++) w[i] = n / 8 + i;
+      if (write(fds[1], buf, PGSIZE) != PGSIZE) exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for (n = 0; n < STREAMSZ; n += PGSIZE) {
+    for (m = 0; m < PGSIZE; m += r) {
+      if ((r = read(fds[0], buf + m, PGSIZE - m)) <= 0) {
+        printf("%s: pipe read failed\n", s);
+        exit(1);
+      }
+    }
+    for (i = 0; i < PGSIZE / 8; i++) {
+      if (w[i] != n / 8 + i) {
+        printf("%s: wrong data at %p through pipe\n", s, n + 8 * i);
+        exit(1);
+      }
+    }
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if (xstatus != 0) exit(1);
+  printf("%dMB: shared memory %d ticks, pipe %d ticks ", STREAMSZ / (1024 * 1024), tshm, uptime() - t0);
+}
+
+// a segment that is created but never attached should
+// go away when its creator exits.
+void shmunused(char *s) {
+  int i, pid, xstatus;
+  void *a;
+
+  for (i = 0; i < 2 * NSHM; i++) {
+    if ((pid = fork()) < 0) {
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if (pid == 0) exit(shmget(0, PGSIZE) < 0);
+    wait(&xstatus);
+    if (xstatus != 0) {
+      printf("%s: shmget failed after %d unused segments\n", s, i);
+      exit(1);
+    }
+  }
+  // the creator can still attach its segment, and
+  // detaching it then frees it.
+  for (i = 0; i < 2 * NSHM; i++) {
+    if ((a = shmat(shmget(0, PGSIZE))) == (void *)-1) {
+      printf("%s: shmat of a new segment failed\n", s);
+      exit(1);
+    }
+    if (shmdt(a) < 0) {
+      printf("%s: shmdt failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// a shmat() that finds no room in the address space
+// shouldn't cost the creator its hold on the segment.
+void shmnoroom(char *s) {
+  int id, pid, xstatus;
+  uint64 top, len;
+  void *a, *m;
+
+  if ((pid = fork()) < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    if ((id = shmget(0, 2 * PGSIZE)) < 0) {
+      printf("%s: shmget failed\n", s);
+      exit(1);
+    }
+    // leave a one-page hole above the heap.
+    top = PGROUNDUP((uint64)sbrk(0));
+    len = MAXUVA - top - PGSIZE;
+    if ((m = mmap(0, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == (void *)-1) {
+      printf("%s: mmap failed\n", s);
+      exit(1);
+    }
+    if (shmat(id) != (void *)-1) {
+      printf("%s: shmat with no room succeeded\n", s);
+      exit(1);
+    }
+    if (munmap(m, len) < 0) {
+      printf("%s: munmap failed\n", s);
+      exit(1);
+    }
+    if ((a = shmat(id)) == (void *)-1) {
+      printf("%s: segment gone after a failed shmat\n", s);
+      exit(1);
+    }
+    if (shmdt(a) < 0) {
+      printf("%s: shmdt failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  exit(xstatus);
+}
+
 // meant to be run w/ at most two CPUs
 void preempt(char *s) {
   int pid1, pid2, pid3;
@@ -1777,12 +2172,15 @@ void dirfile(char *s) {
   close(fd);
 }
 
+// more than the kernel's old fixed-size inode cache held.
+#define NIREF 51
+
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void iref(char *s) {
   int i, fd;
 
-  for (i = 0; i < NINODE + 1; i++) {
+  for (i = 0; i < NIREF; i++) {
     if (mkdir("irefd") != 0) {
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -1802,7 +2200,7 @@ void iref(char *s) {
   }
 
   // clean up
-  for (i = 0; i < NINODE + 1; i++) {
+  for (i = 0; i < NIREF; i++) {
     chdir("..");
     unlink("irefd");
   }
@@ -1811,10 +2209,9 @@ void iref(char *s) {
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// when there is no memory for another process.
 void forktest(char *s) {
-  enum { N = 1000 };
+  enum { N = 100000 };
   int n, pid;
 
   for (n = 0; n < N; n++) {
@@ -1829,7 +2226,7 @@ void forktest(char *s) {
   }
 
   if (n == N) {
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -1907,6 +2304,47 @@ void sbrkbasic(char *s) {
   exit(xstatus);
 }
 
+// use more memory than the machine has, so that much of it
+// goes out to swap, and check that it all comes back intact,
+// in a child that shares it too.
+void swapmuch(char *s) {
+  struct sysinfo info;
+  uint64 n, i;
+  int pid, xstatus;
+  char *a;
+
+  if (sysinfo(&info) < 0) {
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  n = info.totalmem + 8 * 1024 * 1024;
+  a = sbrk(n);
+  if (a == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < n; i += PGSIZE) *(uint64 *)(a + i) = i;
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < n; i += PGSIZE) {
+    if (*(uint64 *)(a + i) != i) {
+      printf("%s: page %d lost in %s\n", s, (int)(i / PGSIZE), pid == 0 ? "child" : "parent");
+      exit(1);
+    }
+  }
+  if (pid == 0) exit(0);
+  wait(&xstatus);
+  if (xstatus != 0) exit(1);
+  if (sbrk(-n) == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk(-n) failed\n", s);
+    exit(1);
+  }
+}
+
 void sbrkmuch(char *s) {
   enum { BIG = 100 * 1024 * 1024 };
   char *c, *oldbrk, *a, *lastaddr, *p;
@@ -2050,6 +2488,72 @@ void sbrkfail(char *s) {
   if (xstatus != -1 && xstatus != 2) exit(1);
 }
 
+// a big, aligned heap may be mapped with 2-megabyte megapages.
+// check that fork, copy-on-write and shrinking the heap to the
+// middle of one all keep the right contents.
+void sbrkmega(char *s) {
+  enum { MEGA = 2 * 1024 * 1024, NMEGA = 4 };
+  char *a, *p;
+  int pid, xstatus;
+
+  // start on a megapage boundary.
+  a = sbrk(0);
+  if (sbrk(MEGA - (uint64)a % MEGA) == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = sbrk(NMEGA * MEGA);
+  if (a == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for (p = a; p < a + NMEGA * MEGA; p += PGSIZE) *(uint64 *)p = (uint64)p;
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    // write one page of each megapage in the child.
+    for (p = a + PGSIZE; p < a + NMEGA * MEGA; p += MEGA) *(uint64 *)p = 0;
+    for (p = a; p < a + NMEGA * MEGA; p += PGSIZE) {
+      if (*(uint64 *)p != ((uint64)p % MEGA == PGSIZE ? 0 : (uint64)p)) {
+        printf("%s: child sees wrong content at %p\n", s, p);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) exit(xstatus);
+
+  for (p = a; p < a + NMEGA * MEGA; p += PGSIZE) {
+    if (*(uint64 *)p != (uint64)p) {
+      printf("%s: parent sees wrong content at %p\n", s, p);
+      exit(1);
+    }
+  }
+
+  // cut the last megapage in half.
+  if (sbrk(-MEGA / 2) == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for (p = a; p < a + NMEGA * MEGA - MEGA / 2; p += PGSIZE) {
+    if (*(uint64 *)p != (uint64)p) {
+      printf("%s: wrong content after shrink at %p\n", s, p);
+      exit(1);
+    }
+  }
+  // the freed half must read as zero when grown back.
+  sbrk(MEGA / 2);
+  if (*(uint64 *)(a + NMEGA * MEGA - PGSIZE) != 0) {
+    printf("%s: shrink didn't free the pages\n", s);
+    exit(1);
+  }
+}
+
 // test reads/writes from/to allocated memory
 void sbrkarg(char *s) {
   char *a;
@@ -2076,6 +2580,82 @@ void sbrkarg(char *s) {
   }
 }
 
+// pgaccess() reports just the pages used since it was last
+// called for them.
+void pgaccesstest(char *s) {
+  char *buf;
+  uint32 abits;
+
+  buf = sbrk(33 * PGSIZE);
+  if (buf == (char *)0xffffffffffffffffL) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  buf = (char *)PGROUNDUP((uint64)buf);
+  if (pgaccess(buf, 32, &abits) < 0) {
+    printf("%s: pgaccess failed\n", s);
+    exit(1);
+  }
+  buf[PGSIZE * 1] += 1;
+  buf[PGSIZE * 2] += 1;
+  buf[PGSIZE * 30] += 1;
+  if (pgaccess(buf, 32, &abits) < 0) {
+    printf("%s: pgaccess failed\n", s);
+    exit(1);
+  }
+  if (abits != ((1 << 1) | (1 << 2) | (1 << 30))) {
+    printf("%s: wrong access bits %x\n", s, abits);
+    exit(1);
+  }
+  if (pgaccess(buf, 32, &abits) < 0 || abits != 0) {
+    printf("%s: access bits not cleared: %x\n", s, abits);
+    exit(1);
+  }
+  if (pgaccess(buf + 1, 32, &abits) >= 0 || pgaccess(buf, 32, (void *)0xeaeb0b5b00002f5e) >= 0) {
+    printf("%s: pgaccess succeeded with bad arguments\n", s);
+    exit(1);
+  }
+}
+
+// a nice value sticks to the process it is set for, and
+// children inherit it.
+void nicetest(char *s) {
+  int pid, xstatus;
+
+  if (setpriority(0, NICEMAX + 1) >= 0 || setpriority(0, NICEMIN - 1) >= 0 || setpriority(-1, 0) >= 0) {
+    printf("%s: setpriority succeeded with bad arguments\n", s);
+    exit(1);
+  }
+  if (setpriority(0, 5) < 0) {
+    printf("%s: setpriority failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    struct procinfo *pi;
+    struct sysinfo info;
+    int i, n;
+    if (sysinfo(&info) < 0 || (pi = malloc(info.nproc * sizeof(*pi))) == 0) exit(1);
+    n = procinfo(pi, info.nproc);
+    for (i = 0; i < n; i++)
+      if (pi[i].pid == getpid()) exit(pi[i].nice == 5 ? 0 : 1);
+    exit(1);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) {
+    printf("%s: child didn't inherit its nice value\n", s);
+    exit(1);
+  }
+  if (setpriority(getpid(), 0) < 0) {
+    printf("%s: setpriority by pid failed\n", s);
+    exit(1);
+  }
+}
+
 void validatetest(char *s) {
   int hi;
   uint64 p;
@@ -2090,6 +2670,27 @@ void validatetest(char *s) {
   }
 }
 
+// wait() with a bad status pointer should fail without
+// losing the child, so that the next wait() still gets it.
+void badwait(char *s) {
+  int pid, xstatus;
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) exit(7);
+  if (wait((int *)0xeaeb0b5b00002f5e) != -1) {
+    printf("%s: wait with a bad address succeeded\n", s);
+    exit(1);
+  }
+  if (wait(&xstatus) != pid || xstatus != 7) {
+    printf("%s: child lost after a bad wait\n", s);
+    exit(1);
+  }
+}
+
 // does unintialized data start out zero?
 char uninit[10000];
 void bsstest(char *s) {
@@ -2487,6 +3088,7 @@ int main(int argc, char *argv[]) {
   } tests[] = {
       {execout, "execout"},
       {copyin, "copyin"},
+      {copyinlazy, "copyinlazy"},
       {copyout, "copyout"},
       {copyinstr1, "copyinstr1"},
       {copyinstr2, "copyinstr2"},
@@ -2513,15 +3115,22 @@ int main(int argc, char *argv[]) {
       {fourfiles, "fourfiles"},
       {sharedfd, "sharedfd"},
       {exectest, "exectest"},
+      {spawntest, "spawntest"},
+      {sharedtext, "sharedtext"},
       {bigargtest, "bigargtest"},
       {bigwrite, "bigwrite"},
       {bsstest, "bsstest"},
       {sbrkbasic, "sbrkbasic"},
       {sbrkmuch, "sbrkmuch"},
+      {pgaccesstest, "pgaccess"},
+      {nicetest, "nice"},
+      {swapmuch, "swapmuch"},
       {kernmem, "kernmem"},
       {sbrkfail, "sbrkfail"},
+      {sbrkmega, "sbrkmega"},
       {sbrkarg, "sbrkarg"},
       {validatetest, "validatetest"},
+      {badwait, "badwait"},
       {stacktest, "stacktest"},
       {opentest, "opentest"},
       {writetest, "writetest"},
@@ -2532,6 +3141,10 @@ int main(int argc, char *argv[]) {
       {iputtest, "iput"},
       {mem, "mem"},
       {pipe1, "pipe1"},
+      {pipebadread, "pipebadread"},
+      {shmstream, "shmstream"},
+      {shmunused, "shmunused"},
+      {shmnoroom, "shmnoroom"},
       {preempt, "preempt"},
       {exitwait, "exitwait"},
       {rmdot, "rmdot"},
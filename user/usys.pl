@@ -36,3 +36,13 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("sysinfo");
+entry("procinfo");
+entry("spawn");
+entry("pgaccess");
+entry("setpriority");
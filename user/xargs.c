@@ -0,0 +1,73 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// Run the command in the arguments once for each line of
+// standard input, with the words of the line appended.
+// Each command is started with spawn(), not fork() and exec().
+
+char line[512];
+char buf[512];
+int bufn, bufi;
+
+// Read a line into line, without its newline.
+// Returns -1 at the end of the input.
+int getline(void) {
+  int n = 0;
+
+  for (;;) {
+    if (bufi == bufn) {
+      if ((bufn = read(0, buf, sizeof(buf))) <= 0) {
+        bufn = bufi = 0;
+        break;
+      }
+      bufi = 0;
+    }
+    char c = buf[bufi++];
+    if (c == '\n') break;
+    if (n == sizeof(line) - 1) {
+      fprintf(2, "xargs: line too long\n");
+      exit(1);
+    }
+    line[n++] = c;
+  }
+  line[n] = 0;
+  return n == 0 && bufn == 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  char *args[MAXARG + 1], *s;
+  int i, n;
+
+  if (argc < 2) {
+    fprintf(2, "usage: xargs command [args...]\n");
+    exit(1);
+  }
+  if (argc - 1 > MAXARG) {
+    fprintf(2, "xargs: too many args\n");
+    exit(1);
+  }
+  for (i = 1; i < argc; i++) args[i - 1] = argv[i];
+
+  while (getline() == 0) {
+    n = argc - 1;
+    for (s = line; *s;) {
+      while (*s == ' ' || *s == '\t') *s++ = 0;
+      if (*s == 0) break;
+      if (n == MAXARG) {
+        fprintf(2, "xargs: too many args\n");
+        exit(1);
+      }
+      args[n++] = s;
+      while (*s && *s != ' ' && *s != '\t') s++;
+    }
+    if (n == argc - 1) continue;
+    args[n] = 0;
+    if (spawn(args[0], args, 0) < 0) {
+      fprintf(2, "xargs: exec %s failed\n", args[0]);
+      exit(1);
+    }
+    wait(0);
+  }
+  exit(0);
+}